@@ -0,0 +1,112 @@
+/*
+
+ SD - a slightly more friendly wrapper for sdfatlib
+
+ This library aims to expose a subset of SD card functionality
+ in the form of a higher level "wrapper" object.
+
+ License: GNU General Public License V3
+          (Because sdfatlib is licensed with this.)
+
+ (C) Copyright 2010 SparkFun Electronics
+
+ */
+
+#include <SD.h>
+
+/*
+
+   _index[i] is the entry, in the directory read at level i, of the
+   directory read at level i + 1.  Level 0 is read with the SdFile of the
+   File passed to begin(), deeper levels with _dir.  A directory has no
+   link back to its parent on exFAT, so up() opens the parent again from
+   the top by index, a few cached block reads, and seeks past the entry.
+
+ */
+
+DirIterator::DirIterator(void) {
+  _top = 0;
+  _depth = 0;
+  _recursive = false;
+  _enter = false;
+}
+
+boolean DirIterator::begin(File &dir, boolean recursive) {
+  _top = 0;
+  if (!dir._file || !dir._file->isDir())
+    return false;
+
+  _top = dir._file;
+  _top->rewind();
+  _depth = 0;
+  _recursive = recursive;
+  _enter = false;
+  return true;
+}
+
+boolean DirIterator::next(DirEntry *entry) {
+  dir_t p;
+  uint16_t index;
+  int8_t n;
+
+  if (!_top)
+    return false;
+
+  if (_enter) {
+    // read the directory returned last, its entry is _index[_depth]
+    SdFile child;
+    if (!child.open(_depth ? &_dir : _top, _index[_depth], O_READ))
+      goto fail;
+    _dir = child;
+    _depth++;
+    _enter = false;
+  }
+  while ((n = (_depth ? &_dir : _top)->readDirIndex(&p, &index)) == 0) {
+    // end of this directory, carry on in its parent
+    if (!_depth) {
+      _top = 0;
+      return false;
+    }
+    if (!up())
+      goto fail;
+  }
+  if (n < 0)
+    goto fail;
+
+  SdFile::dirName(p, entry->name);
+  entry->attributes = p.attributes;
+  entry->depth = _depth;
+  entry->size = DIR_IS_SUBDIR(&p) ? 0 : p.fileSize;
+  entry->firstCluster = (uint32_t)p.firstClusterHigh << 16 | p.firstClusterLow;
+  entry->createDate = p.creationDate;
+  entry->createTime = p.creationTime;
+  entry->writeDate = p.lastWriteDate;
+  entry->writeTime = p.lastWriteTime;
+  if (_recursive && DIR_IS_SUBDIR(&p) && _depth < SD_DIR_WALK_DEPTH) {
+    _index[_depth] = index;
+    _enter = true;
+  }
+  return true;
+
+ fail:
+  _top = 0;
+  return false;
+}
+
+boolean DirIterator::up(void) {
+  _depth--;
+  if (!_depth)
+    // the top is still just past the entry of the directory left
+    return true;
+
+  SdFile *parent = _top;
+  for (uint8_t i = 0; i < _depth; i++) {
+    SdFile child;
+    if (!child.open(parent, _index[i], O_READ))
+      return false;
+    _dir = child;
+    parent = &_dir;
+  }
+  // past the entry, or into the rest of its exFAT set which is skipped
+  return _dir.seekSet(((uint32_t)_index[_depth] + 1) << 5);
+}
@@ -14,13 +14,33 @@
 
 #include <SD.h>
 
+#if SD_MAX_OPEN_FILES > 8
+#error SD_MAX_OPEN_FILES must be no more than eight
+#endif
+
 /* for debugging file open/close leaks
    uint8_t nfilecount=0;
 */
 
+// SdFile handles for open files, bit i of filePoolUsed is set
+// while filePool[i] belongs to a File.  Files opened while the pool
+// is empty get an SdFile from the heap.
+static SdFile filePool[SD_MAX_OPEN_FILES];
+static uint8_t filePoolUsed = 0;
+
 File::File(SdFile f, char *n) {
-  // oh man you are kidding me, new() doesnt exist? Ok we do it by hand!
-  _file = (SdFile *)malloc(sizeof(SdFile)); 
+  // take a free handle from the pool
+  _file = 0;
+  _name[0] = 0;
+  for (uint8_t i = 0; i < SD_MAX_OPEN_FILES; i++) {
+    if (!(filePoolUsed & (1 << i))) {
+      filePoolUsed |= 1 << i;
+      _file = &filePool[i];
+      break;
+    }
+  }
+  if (!_file)
+    _file = (SdFile *)malloc(sizeof(SdFile));
   if (_file) {
     memcpy(_file, &f, sizeof(SdFile));
     
@@ -104,9 +124,7 @@ int File::peek() {
   if (! _file) 
     return 0;
 
-  int c = _file->read();
-  if (c != -1) _file->seekCur(-1);
-  return c;
+  return _file->peek();
 }
 
 int File::read() {
@@ -151,10 +169,26 @@ uint32_t File::size() {
   return _file->fileSize();
 }
 
+// bytes at the start of the file that are safely on the card
+uint32_t File::durableSize() {
+  if (! _file) return 0;
+  return _file->durableSize();
+}
+
+// flush if a write-behind limit set by SD.setWriteBehind() is reached
+boolean File::syncBehind() {
+  if (! _file) return false;
+  return _file->syncBehind();
+}
+
 void File::close() {
   if (_file) {
     _file->close();
-    free(_file); 
+    // return handle to the pool, or to the heap if it came from there
+    if (_file >= filePool && _file < filePool + SD_MAX_OPEN_FILES)
+      filePoolUsed &= ~(1 << (_file - filePool));
+    else
+      free(_file);
     _file = 0;
 
     /* for debugging file open/close leaks
@@ -0,0 +1,130 @@
+/*
+
+ SD - a slightly more friendly wrapper for sdfatlib
+
+ This library aims to expose a subset of SD card functionality
+ in the form of a higher level "wrapper" object.
+
+ License: GNU General Public License V3
+          (Because sdfatlib is licensed with this.)
+
+ (C) Copyright 2010 SparkFun Electronics
+
+ */
+
+#include <SD.h>
+
+#if SD_LOG_BLOCK_COUNT & (SD_LOG_BLOCK_COUNT - 1)
+#error SD_LOG_BLOCK_COUNT must be a power of two
+#endif
+
+/*
+
+   The ring is SD_LOG_BLOCK_COUNT blocks.  push() fills block
+   (_filled % SD_LOG_BLOCK_COUNT) and bumps _filled when it is full.
+   drain() writes block (_drained % SD_LOG_BLOCK_COUNT) and bumps
+   _drained.  Each count has one writer and is a single byte, so no
+   locking is needed between the handler and loop().
+
+ */
+
+LogFile::LogFile(void) {
+  _recordSize = 0;
+  _fill = 0;
+  _filled = 0;
+  _drained = 0;
+  _overruns = 0;
+  _records = 0;
+}
+
+boolean LogFile::begin(char *filename, uint32_t size, uint8_t recordSize) {
+  if (_recordSize || !recordSize)
+    return false;
+
+  _file = SD.open(filename, FILE_WRITE | O_TRUNC | FILE_RAW_LOG, size);
+  if (!_file)
+    return false;
+
+  _fill = 0;
+  _filled = 0;
+  _drained = 0;
+  _overruns = 0;
+  _records = 0;
+  // push() starts accepting records here
+  _recordSize = recordSize;
+  return true;
+}
+
+boolean LogFile::push(const void *record) {
+  const uint8_t *src = (const uint8_t *)record;
+  uint8_t n = _recordSize;
+  if (!n)
+    return false;
+
+  // the block being filled counts as used
+  uint8_t used = _filled - _drained;
+  if ((uint16_t)(SD_LOG_BLOCK_COUNT - used) * 512 - _fill < n) {
+    _overruns++;
+    return false;
+  }
+  uint8_t filled = _filled;
+  while (n) {
+    uint16_t m = 512 - _fill;
+    if (m > n) m = n;
+    memcpy(&_buf[filled & (SD_LOG_BLOCK_COUNT - 1)][_fill], src, m);
+    src += m;
+    n -= m;
+    _fill += m;
+    if (_fill == 512) {
+      _fill = 0;
+      filled++;
+      // the block must be complete before drain() can see it
+      __asm__ __volatile__("" ::: "memory");
+      _filled = filled;
+    }
+  }
+  _records++;
+  return true;
+}
+
+boolean LogFile::drain(void) {
+  if (!_recordSize)
+    return false;
+
+  // unlike File::write(), SdFile::write() returns the count for any ARDUINO
+  while (_drained != _filled) {
+    if (_file._file->write(_buf[_drained & (SD_LOG_BLOCK_COUNT - 1)], 512) != 512)
+      return false;
+    _drained++;
+  }
+  return true;
+}
+
+boolean LogFile::end(void) {
+  if (!_recordSize)
+    return false;
+
+  boolean ok = drain();
+  _recordSize = 0;
+  if (ok && _fill)
+    ok = _file._file->write(_buf[_filled & (SD_LOG_BLOCK_COUNT - 1)], _fill) == _fill;
+  // a raw log is cut to the data written when it is closed
+  _file.close();
+  return ok;
+}
+
+uint32_t LogFile::overrunCount(void) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint32_t n = _overruns;
+  SREG = oldSREG;
+  return n;
+}
+
+uint32_t LogFile::recordCount(void) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint32_t n = _records;
+  SREG = oldSREG;
+  return n;
+}
@@ -0,0 +1,154 @@
+/*
+
+ SD - a slightly more friendly wrapper for sdfatlib
+
+ This library aims to expose a subset of SD card functionality
+ in the form of a higher level "wrapper" object.
+
+ License: GNU General Public License V3
+          (Because sdfatlib is licensed with this.)
+
+ (C) Copyright 2010 SparkFun Electronics
+
+ */
+
+#include <SD.h>
+
+/*
+
+   A record file is a series of 512 byte blocks, all little endian.
+
+   Block 0 is the schema:
+     0   "SDRH"
+     4   format version, 1
+     5   number of fields
+     6   record size in bytes, uint16
+     8   frame size in bytes, uint16, 512
+     10  zero
+     16  one 12 byte entry per field, the name padded with zeros to
+         11 bytes followed by the field type
+
+   Each later block is a frame:
+     0   "SDRF", the sync marker
+     4   frame number, uint32, counting from 0
+     8   (504 / record size) records, then zeros to the end of the block
+
+   Only the last frame may be short, it ends at the end of the file.  A
+   reader that finds a block without the sync marker skips it and carries
+   on with the next block, and a gap in the frame numbers shows what was
+   lost.
+
+ */
+
+#define RECORD_FRAME_SIZE 512
+#define RECORD_FRAME_HEADER 8
+
+static const uint8_t zeros[16] = {0};
+
+RecordFile::RecordFile(void) {
+  _recordSize = 0;
+  _free = 0;
+  _frames = 0;
+  _records = 0;
+}
+
+boolean RecordFile::pad(uint16_t n) {
+  while (n) {
+    uint8_t m = n < sizeof(zeros) ? n : sizeof(zeros);
+    uint32_t pos = _file.position();
+    _file.write(zeros, m);
+    if (_file.position() != pos + m)
+      return false;
+    n -= m;
+  }
+  return true;
+}
+
+boolean RecordFile::begin(char *filename, const RecordField *fields,
+                          uint8_t fieldCount) {
+  if (_file || !fieldCount || fieldCount > RECORD_MAX_FIELDS)
+    return false;
+
+  uint16_t size = 0;
+  for (uint8_t i = 0; i < fieldCount; i++)
+    size += fields[i].type & 0X0F;
+  if (!size || size > RECORD_FRAME_SIZE - RECORD_FRAME_HEADER)
+    return false;
+
+  _file = SD.open(filename, FILE_WRITE | O_TRUNC);
+  if (!_file)
+    return false;
+
+  uint8_t head[16] = {'S', 'D', 'R', 'H', 1, fieldCount,
+    (uint8_t)size, (uint8_t)(size >> 8),
+    (uint8_t)RECORD_FRAME_SIZE, (uint8_t)(RECORD_FRAME_SIZE >> 8)};
+  _file.write(head, sizeof(head));
+  for (uint8_t i = 0; i < fieldCount; i++) {
+    uint8_t entry[12];
+    memset(entry, 0, sizeof(entry));
+    strncpy((char *)entry, fields[i].name, RECORD_NAME_SIZE);
+    entry[11] = fields[i].type;
+    _file.write(entry, sizeof(entry));
+  }
+  uint16_t used = sizeof(head) + 12 * fieldCount;
+  if (_file.position() != used || !pad(RECORD_FRAME_SIZE - used)) {
+    _file.close();
+    return false;
+  }
+  _recordSize = size;
+  _free = 0;
+  _frames = 0;
+  _records = 0;
+  return true;
+}
+
+boolean RecordFile::write(const void *record) {
+  if (!_file)
+    return false;
+
+  uint32_t pos = _file.position();
+  uint16_t n = _recordSize;
+  if (_free < _recordSize) {
+    // finish this frame and start the next
+    uint8_t head[RECORD_FRAME_HEADER] = {'S', 'D', 'R', 'F',
+      (uint8_t)_frames, (uint8_t)(_frames >> 8),
+      (uint8_t)(_frames >> 16), (uint8_t)(_frames >> 24)};
+    if (!pad(_free))
+      goto fail;
+    _file.write(head, sizeof(head));
+    n += _free + sizeof(head);
+  }
+  _file.write((const uint8_t *)record, _recordSize);
+  if (_file.position() != pos + n)
+    goto fail;
+  if (n != _recordSize) {
+    _frames++;
+    _free = RECORD_FRAME_SIZE - RECORD_FRAME_HEADER;
+  }
+  _free -= _recordSize;
+  _records++;
+  return true;
+
+ fail:
+  // keep later records in step with the frames
+  _file.seek(pos);
+  return false;
+}
+
+boolean RecordFile::flush(void) {
+  if (!_file)
+    return false;
+
+  _file.flush();
+  return _file.durableSize() == _file.size();
+}
+
+boolean RecordFile::end(void) {
+  if (!_file)
+    return false;
+
+  // the last frame is left short, a reader stops at the end of the file
+  boolean ok = flush();
+  _file.close();
+  return ok;
+}
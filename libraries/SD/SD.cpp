@@ -468,6 +468,54 @@ File SDClass::open(char *filepath, uint8_t mode) {
   return File(file, filepath);
 }
 
+File SDClass::open(char *filepath, uint8_t mode, uint32_t size) {
+  /*
+
+     Create a file of `size` bytes in contiguous clusters and open it
+     at the start for writing.
+
+     The blocks of the file are erased if the card supports it.  With
+     FILE_RAW_LOG in `mode` the file is truncated to the written length
+     when it is closed.
+
+   */
+
+  int pathidx;
+
+  SdFile parentdir = getParentDir(filepath, &pathidx);
+
+  filepath += pathidx;
+
+  // failed to open a subdir or no file name
+  if (!parentdir.isOpen())
+    return File();
+  if (! filepath[0]) {
+    if (!parentdir.isRoot()) parentdir.close();
+    return File();
+  }
+
+  // there is a special case for the Root directory since its a static dir
+  SdFile *dir = parentdir.isRoot() ? &SD.root : &parentdir;
+
+  if (mode & O_TRUNC) {
+    // replace any existing file
+    SdFile::remove(dir, filepath);
+  }
+  SdFile file;
+  boolean created = file.createContiguous(dir, filepath, size);
+
+  if (!parentdir.isRoot()) {
+    parentdir.close();
+  }
+  if (!created)
+    return File();
+
+  // createContiguous() erased the file ahead of logging
+  if (mode & FILE_RAW_LOG)
+    file.setRawLog();
+  return File(file, filepath);
+}
+
 
 /*
 File SDClass::open(char *filepath, uint8_t mode) {
@@ -562,53 +610,38 @@ boolean SDClass::remove(char *filepath) {
   return walkPath(filepath, root, callback_remove);
 }
 
-void SDClass::enableCRC(boolean mode) {
-  card.enableCRC(mode);
+boolean SDClass::enableCRC(boolean mode) {
+  return card.enableCRC(mode);
 }
 
+int32_t SDClass::freeClusterCount(void) {
+  return volume.freeClusterCount();
+}
 
-// allows you to recurse into a directory
-File File::openNextFile(uint8_t mode) {
-  dir_t p;
-
-  //Serial.print("\t\treading dir...");
-  while (_file->readDir(&p) > 0) {
+boolean SDClass::setFatMirror(uint8_t mode) {
+  return volume.setFatMirror(mode);
+}
 
-    // done if past last used entry
-    if (p.name[0] == DIR_NAME_FREE) {
-      //Serial.println("end");
-      return File();
-    }
+void SDClass::setWriteBehind(uint32_t bytes, uint16_t blocks, uint16_t ms) {
+  SdFile::setWriteBehind(bytes, blocks, ms);
+}
 
-    // skip deleted entry and entries for . and  ..
-    if (p.name[0] == DIR_NAME_DELETED || p.name[0] == '.') {
-      //Serial.println("dots");
-      continue;
-    }
 
-    // only list subdirectories and files
-    if (!DIR_IS_FILE_OR_SUBDIR(&p)) {
-      //Serial.println("notafile");
-      continue;
-    }
+// allows you to recurse into a directory
+File File::openNextFile(uint8_t mode) {
+  dir_t p;
+  uint16_t index;
 
-    // print file name with possible blank fill
-    SdFile f;
-    char name[13];
-    _file->dirName(p, name);
-    //Serial.print("try to open file ");
-    //Serial.println(name);
-
-    if (f.open(_file, name, mode)) {
-      //Serial.println("OK!");
-      return File(f, name);    
-    } else {
-      //Serial.println("ugh");
-      return File();
-    }
-  }
+  // readDirIndex() skips free and deleted entries, long names and dots
+  if (!_file || _file->readDirIndex(&p, &index) <= 0)
+    return File();
 
-  //Serial.println("nothing");
+  // open by index, opening by name would search the directory again
+  SdFile f;
+  char name[13];
+  _file->dirName(p, name);
+  if (f.open(_file, index, mode))
+    return File(f, name);
   return File();
 }
 
@@ -26,6 +26,33 @@
 
 #define FILE_READ O_READ
 #define FILE_WRITE (O_READ | O_WRITE | O_CREAT)
+// Mode bit for open() with a preallocated size, the file is written as a
+// raw log.  See SdFile::setRawLog().
+#define FILE_RAW_LOG 0X80
+
+// Number of files that can be open without touching the heap.  Each open
+// File takes an SdFile from a static pool of this size.  Once the pool is
+// empty each further File mallocs its SdFile and frees it on close, as the
+// library always did, so more files can be open if there is free RAM.  A
+// directory listed with openNextFile() holds one File per level; a
+// DirIterator lists a tree without opening files.  At most eight.
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_MAX_OPEN_FILES 4
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_MAX_OPEN_FILES 2
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+
+// Number of 512 byte blocks in a LogFile ring buffer, a power of two.
+// One block fills from interrupts while the others are written.
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_LOG_BLOCK_COUNT 4
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_LOG_BLOCK_COUNT 2
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+
+// Most subdirectory levels a recursive DirIterator walks below the
+// directory it starts in.  Each level costs two bytes.
+#define SD_DIR_WALK_DEPTH 8
 
 class File : public Stream {
  private:
@@ -53,6 +80,8 @@ public:
   boolean seek(uint32_t pos);
   uint32_t position();
   uint32_t size();
+  uint32_t durableSize();
+  boolean syncBehind();
   void close();
   operator bool();
   char * name();
@@ -60,6 +89,140 @@ public:
   boolean isDirectory(void);
   File openNextFile(uint8_t mode = O_RDONLY);
   void rewindDirectory(void);
+
+  friend class DirIterator;
+  friend class LogFile;
+};
+
+// One entry from DirIterator::next().  Dates and times are in FAT
+// format, see FAT_YEAR() and the other functions in utility/SdFat.h.
+struct DirEntry {
+  char name[13];            // 8.3 name with a dot, zero terminated
+  uint8_t attributes;       // DIR_ATT_ bits
+  uint8_t depth;            // zero for entries of the starting directory
+  uint32_t size;            // file size in bytes, zero for a directory
+  uint32_t firstCluster;    // zero for an empty file
+  uint16_t createDate;
+  uint16_t createTime;
+  uint16_t writeDate;
+  uint16_t writeTime;
+  boolean isDirectory(void) {return attributes & DIR_ATT_DIRECTORY;}
+};
+
+// List a directory without opening a File for each entry.  Entries are
+// copied from the cached directory blocks, nothing is allocated.  A
+// recursive walk returns the entries of a subdirectory right after the
+// subdirectory, down to SD_DIR_WALK_DEPTH levels.  Deeper directories are
+// returned but not entered.  The directory passed to begin() must stay
+// open for the walk, other files may be opened, written and removed.
+class DirIterator {
+ private:
+  SdFile *_top;                         // directory passed to begin()
+  SdFile _dir;                          // directory being read below _top
+  uint16_t _index[SD_DIR_WALK_DEPTH];   // entry of each level in its parent
+  uint8_t _depth;                       // levels open below _top
+  boolean _recursive;
+  boolean _enter;                       // enter the last entry on next()
+
+  boolean up(void);
+
+public:
+  DirIterator(void);
+  // Start listing `dir` from its first entry.
+  boolean begin(File &dir, boolean recursive = false);
+  // Copy the next entry to `entry`.  Returns false at the end of the
+  // walk or on an error.
+  boolean next(DirEntry *entry);
+  // Don't enter the directory next() just returned.
+  void skip(void) {_enter = false;}
+};
+
+// Log fixed size records from an interrupt handler to a preallocated raw
+// log file.  push() copies a record into a ring of SD_LOG_BLOCK_COUNT
+// blocks and never waits on the card.  drain() is called from loop() and
+// writes each block as it fills.  A record that finds the ring full is
+// dropped and counted in overrunCount().  Only one handler may push.
+class LogFile {
+ private:
+  File _file;
+  uint8_t _buf[SD_LOG_BLOCK_COUNT][512];
+  uint8_t _recordSize;
+  uint16_t _fill;                  // bytes in the block being filled
+  volatile uint8_t _filled;        // blocks filled, written by push()
+  volatile uint8_t _drained;       // blocks written, written by drain()
+  volatile uint32_t _overruns;
+  volatile uint32_t _records;
+
+public:
+  LogFile(void);
+  // Create `filename` as a contiguous file of `size` bytes, replacing any
+  // existing file, for records of `recordSize` bytes.
+  boolean begin(char *filename, uint32_t size, uint8_t recordSize);
+  // Add a record, safe to call from an interrupt handler.  Returns false
+  // if the ring is full or the log isn't open.
+  boolean push(const void *record);
+  // Write the blocks filled by push().  Returns false on a write error,
+  // which includes reaching the end of the preallocated file.
+  boolean drain(void);
+  // Write the last partial block and close the file.  Stop pushing first.
+  boolean end(void);
+  // Number of records dropped because the ring was full.
+  uint32_t overrunCount(void);
+  // Number of records pushed.
+  uint32_t recordCount(void);
+  operator bool() {return _file;}
+};
+
+// Field types for RecordFile.  The low nibble is the size in bytes.
+#define RECORD_UINT8 0X01
+#define RECORD_INT8 0X11
+#define RECORD_UINT16 0X02
+#define RECORD_INT16 0X12
+#define RECORD_UINT32 0X04
+#define RECORD_INT32 0X14
+#define RECORD_FLOAT 0X24
+
+// Most fields in a RecordFile schema, and most characters in a field name.
+#define RECORD_MAX_FIELDS 41
+#define RECORD_NAME_SIZE 10
+
+// One field of a RecordFile record, in the order it is stored.
+struct RecordField {
+  const char *name;
+  uint8_t type;
+};
+
+// Write fixed size binary records in block sized frames.  The first block
+// of the file holds the schema, each later block is a frame that starts
+// with a sync marker and frame number and holds as many whole records as
+// fit.  Records are stored as they are in RAM, which is little endian with
+// no padding on AVR.  extras/host/RecordRead.cpp converts a file to CSV.
+class RecordFile {
+ private:
+  File _file;
+  uint16_t _recordSize;
+  uint16_t _free;                  // bytes left in the current frame
+  uint32_t _frames;
+  uint32_t _records;
+
+  boolean pad(uint16_t n);
+
+public:
+  RecordFile(void);
+  // Create `filename`, replacing any existing file, and write the schema
+  // for records of `fieldCount` fields.
+  boolean begin(char *filename, const RecordField *fields, uint8_t fieldCount);
+  // Add a record.  Returns false on a write error.
+  boolean write(const void *record);
+  // Make the records written so far durable.
+  boolean flush(void);
+  // Flush and close the file.
+  boolean end(void);
+  // Number of records written.
+  uint32_t recordCount(void) {return _records;}
+  // Size of a record in bytes, the sum of the field sizes.
+  uint16_t recordSize(void) {return _recordSize;}
+  operator bool() {return _file;}
 };
 
 class SDClass {
@@ -79,9 +242,16 @@ public:
   
   // Open the specified file/directory with the supplied mode (e.g. read or
   // write, etc). Returns a File object for interacting with the file.
-  // Note that currently only one file can be open at a time.
+  // See SD_MAX_OPEN_FILES for how many files can be open at a time.
   File open(char *filename, uint8_t mode = FILE_READ);
 
+  // Create a contiguous file of `size` bytes and erase its blocks so
+  // writes don't wait on the card's allocation.  An existing file is
+  // replaced if `mode` has O_TRUNC, otherwise it is an error.  Add
+  // FILE_RAW_LOG to `mode` to log into the file with no FAT updates
+  // until it is closed.
+  File open(char *filename, uint8_t mode, uint32_t size);
+
   // Methods to determine if the requested file path exists.
   boolean exists(char *filepath);
 
@@ -94,7 +264,26 @@ public:
   
   boolean rmdir(char *filepath);
 
-  void enableCRC(boolean mode);
+  // Protect commands and data blocks with CRCs, checked by the card on
+  // writes and by the library on reads.  Call before or after begin().
+  boolean enableCRC(boolean mode);
+
+  // Number of free clusters on the card, or -1 on error.  The first call
+  // reads the whole FAT, later calls return a count kept up to date.
+  int32_t freeClusterCount(void);
+
+  // Choose when the second FAT is written: FAT_MIRROR_WRITE with every
+  // FAT block (the default), FAT_MIRROR_DEFER when a file is flushed or
+  // closed, or FAT_MIRROR_OFF never, for cards only used for logging.
+  boolean setFatMirror(uint8_t mode);
+
+  // Flush files automatically once `bytes` bytes or `blocks` blocks have
+  // been written, or `ms` milliseconds have passed since the first write,
+  // whichever comes first.  Zero turns a limit off.  The limits are checked
+  // on each write and by File.syncBehind(), so call that from loop() for
+  // the `ms` limit to apply once writes stop.  File.durableSize() tells
+  // how much of a file is safely on the card.
+  void setWriteBehind(uint32_t bytes, uint16_t blocks, uint16_t ms);
 
 private:
 
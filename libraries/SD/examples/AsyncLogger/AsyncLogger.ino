@@ -0,0 +1,109 @@
+/*
+  SD card interrupt logger
+
+ This example samples four analog inputs from a timer interrupt
+ 500 times a second and logs them to an SD card with LogFile.
+ The timer interrupt only starts the first conversion, the ADC
+ interrupt collects each reading and starts the next one, so no
+ handler waits on the ADC.  The last reading copies the sample
+ into RAM, so no samples are lost while the card is busy writing.
+ loop() writes the data to the card a block at a time.
+
+ Each record is a 4 byte micros() time stamp followed by four
+ 2 byte readings, stored little endian.
+
+ The circuit:
+ * analog sensors on analog pins 0 to 3
+ * SD card attached to SPI bus as follows:
+ ** UNO:  MOSI - pin 11, MISO - pin 12, CLK - pin 13, CS - pin 4 (CS pin can be changed)
+  and pin #10 (SS) must be an output
+ ** Mega:  MOSI - pin 51, MISO - pin 50, CLK - pin 52, CS - pin 4 (CS pin can be changed)
+  and pin #52 (SS) must be an output
+
+ This example code is in the public domain.
+
+ */
+
+#include <SD.h>
+
+// On the Ethernet Shield, CS is pin 4.
+const int chipSelect = 4;
+
+// Samples per second, and seconds to log.
+const unsigned int sampleRate = 500;
+const unsigned long logSeconds = 60;
+
+struct Sample {
+  unsigned long time;
+  int value[4];
+};
+
+LogFile logFile;
+
+// sample being converted, and the input the ADC is reading
+Sample sample;
+byte channel;
+
+ISR(TIMER1_COMPA_vect)
+{
+  sample.time = micros();
+  channel = 0;
+  // AVcc reference, input 0, then start the conversion
+  ADMUX = 1 << REFS0;
+  ADCSRA |= (1 << ADSC) | (1 << ADIE);
+}
+
+ISR(ADC_vect)
+{
+  sample.value[channel] = ADC;
+  if (++channel < 4) {
+    ADMUX = (1 << REFS0) | channel;
+    ADCSRA |= 1 << ADSC;
+  } else {
+    ADCSRA &= ~(1 << ADIE);
+    logFile.push(&sample);
+  }
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  while (!Serial) {
+    ; // wait for serial port to connect. Needed for Leonardo only
+  }
+  pinMode(SS, OUTPUT);
+
+  if (!SD.begin(chipSelect)) {
+    Serial.println("Card failed, or not present");
+    while (1) ;
+  }
+  // room for every sample, the file is cut to the data logged on close
+  unsigned long size = sampleRate * logSeconds * sizeof(Sample);
+  if (!logFile.begin("samples.bin", size, sizeof(Sample))) {
+    Serial.println("error creating samples.bin");
+    while (1) ;
+  }
+  Serial.println("logging...");
+
+  // timer 1 in CTC mode, prescale 64, interrupt at sampleRate
+  cli();
+  TCCR1A = 0;
+  TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10);
+  OCR1A = F_CPU / 64 / sampleRate - 1;
+  TIMSK1 = 1 << OCIE1A;
+  sei();
+}
+
+void loop()
+{
+  if (!logFile.drain() || logFile.recordCount() >= sampleRate * logSeconds) {
+    TIMSK1 = 0;
+    ADCSRA &= ~(1 << ADIE);
+    logFile.end();
+    Serial.print("samples: ");
+    Serial.println(logFile.recordCount());
+    Serial.print("overruns: ");
+    Serial.println(logFile.overrunCount());
+    while (1) ;
+  }
+}
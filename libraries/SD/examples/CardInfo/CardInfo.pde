@@ -83,8 +83,13 @@ void setup()
 
   // print the type and size of the first FAT-type volume
   uint32_t volumesize;
-  Serial.print("\nVolume type is FAT");
-  Serial.println(volume.fatType(), DEC);
+  Serial.print("\nVolume type is ");
+  if (volume.fatType() == 64) {
+    Serial.println("exFAT");
+  } else {
+    Serial.print("FAT");
+    Serial.println(volume.fatType(), DEC);
+  }
   Serial.println();
   
   volumesize = volume.blocksPerCluster();    // clusters are collections of blocks
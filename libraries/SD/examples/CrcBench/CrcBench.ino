@@ -0,0 +1,101 @@
+/*
+  SD card CRC benchmark
+
+ This example measures how fast a file is written and read with
+ CRC protection off and on.  With SD.enableCRC(true) every command
+ and data block carries a CRC.  The card rejects blocks damaged on
+ the way in, and the library rejects blocks damaged on the way out.
+ Use it on long or noisy SPI cables.
+
+ The test file is 512 KB and is removed at the end.
+
+ The circuit:
+ * SD card attached to SPI bus as follows:
+ ** UNO:  MOSI - pin 11, MISO - pin 12, CLK - pin 13, CS - pin 4 (CS pin can be changed)
+  and pin #10 (SS) must be an output
+ ** Mega:  MOSI - pin 51, MISO - pin 50, CLK - pin 52, CS - pin 4 (CS pin can be changed)
+  and pin #52 (SS) must be an output
+
+ This example code is in the public domain.
+
+ */
+
+#include <SD.h>
+
+// On the Ethernet Shield, CS is pin 4.
+const int chipSelect = 4;
+
+// Size of the test file in 512 byte blocks.
+const unsigned int blockCount = 1024;
+
+uint8_t buf[512];
+
+// Print the rate for blockCount blocks in t milliseconds.
+void printRate(const char *label, unsigned long t)
+{
+  Serial.print(label);
+  Serial.print(blockCount * 512UL / t);
+  Serial.println(" KB/s");
+}
+
+boolean test(boolean crc)
+{
+  if (!SD.enableCRC(crc)) {
+    Serial.println("enableCRC failed");
+    return false;
+  }
+  Serial.println(crc ? "CRC on" : "CRC off");
+  SD.remove("crcbench.dat");
+  File file = SD.open("crcbench.dat", FILE_WRITE);
+  if (!file) {
+    Serial.println("error opening crcbench.dat");
+    return false;
+  }
+  for (unsigned int i = 0; i < sizeof(buf); i++) {
+    buf[i] = i;
+  }
+  unsigned long t = millis();
+  for (unsigned int i = 0; i < blockCount; i++) {
+    if (file.write(buf, sizeof(buf)) != sizeof(buf)) {
+      Serial.println("write failed");
+      return false;
+    }
+  }
+  file.close();
+  printRate("  write ", millis() - t);
+
+  file = SD.open("crcbench.dat");
+  t = millis();
+  for (unsigned int i = 0; i < blockCount; i++) {
+    if (file.read(buf, sizeof(buf)) != sizeof(buf)) {
+      Serial.println("read failed");
+      return false;
+    }
+  }
+  file.close();
+  printRate("  read  ", millis() - t);
+  return true;
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  while (!Serial) {
+    ; // wait for serial port to connect. Needed for Leonardo only
+  }
+  pinMode(SS, OUTPUT);
+
+  if (!SD.begin(chipSelect)) {
+    Serial.println("Card failed, or not present");
+    return;
+  }
+  if (test(false) && test(true)) {
+    Serial.println("done");
+  }
+  SD.enableCRC(false);
+  SD.remove("crcbench.dat");
+}
+
+void loop()
+{
+}
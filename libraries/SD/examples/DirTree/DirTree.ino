@@ -0,0 +1,76 @@
+/*
+  SD card directory tree
+
+ This example lists every file on the card with DirIterator, with
+ the size and last write date of each file.  Unlike listfiles, no
+ File is opened for each entry, so a card with thousands of files
+ is listed quickly and directories can be nested deeper than the
+ number of files that can be open at once.
+
+ The circuit:
+ * SD card attached to SPI bus as follows:
+ ** UNO:  MOSI - pin 11, MISO - pin 12, CLK - pin 13, CS - pin 4 (CS pin can be changed)
+  and pin #10 (SS) must be an output
+ ** Mega:  MOSI - pin 51, MISO - pin 50, CLK - pin 52, CS - pin 4 (CS pin can be changed)
+  and pin #52 (SS) must be an output
+
+ This example code is in the public domain.
+
+ */
+
+#include <SD.h>
+
+// On the Ethernet Shield, CS is pin 4.
+const int chipSelect = 4;
+
+void setup()
+{
+  Serial.begin(9600);
+  while (!Serial) {
+    ; // wait for serial port to connect. Needed for Leonardo only
+  }
+  pinMode(SS, OUTPUT);
+
+  if (!SD.begin(chipSelect)) {
+    Serial.println("Card failed, or not present");
+    return;
+  }
+
+  File root = SD.open("/");
+  DirIterator dir;
+  DirEntry entry;
+  unsigned long files = 0;
+  unsigned long bytes = 0;
+  dir.begin(root, true);
+  while (dir.next(&entry)) {
+    for (uint8_t i = 0; i < entry.depth; i++) {
+      Serial.print("  ");
+    }
+    Serial.print(entry.name);
+    if (entry.isDirectory()) {
+      Serial.println("/");
+      continue;
+    }
+    Serial.print('\t');
+    Serial.print(entry.size);
+    Serial.print('\t');
+    Serial.print(FAT_YEAR(entry.writeDate));
+    Serial.print('-');
+    Serial.print(FAT_MONTH(entry.writeDate));
+    Serial.print('-');
+    Serial.println(FAT_DAY(entry.writeDate));
+    files++;
+    bytes += entry.size;
+  }
+  root.close();
+
+  Serial.print(files);
+  Serial.print(" files, ");
+  Serial.print(bytes);
+  Serial.println(" bytes");
+}
+
+void loop()
+{
+  // nothing happens after setup finishes.
+}
@@ -0,0 +1,100 @@
+/*
+  SD card binary record logger
+
+ This example reads the eight inputs of an 8 way analog multiplexer
+ and logs them to an SD card with RecordFile.  Each sample is stored
+ as a 14 byte binary record instead of a line of text, so there is no
+ number formatting and much less to write.
+
+ The file starts with a schema naming each field.  Copy it to a
+ computer and convert it with the reader in extras/host:
+
+   recordread MUXLOG.BIN > muxlog.csv
+
+ The circuit:
+ * multiplexer output on analog pin 0, select lines S0, S1 and S2
+   on digital pins 5, 6 and 7
+ * SD card attached to SPI bus as follows:
+ ** UNO:  MOSI - pin 11, MISO - pin 12, CLK - pin 13, CS - pin 4 (CS pin can be changed)
+  and pin #10 (SS) must be an output
+ ** Mega:  MOSI - pin 51, MISO - pin 50, CLK - pin 52, CS - pin 4 (CS pin can be changed)
+  and pin #52 (SS) must be an output
+
+ This example code is in the public domain.
+
+ */
+
+#include <SD.h>
+
+// On the Ethernet Shield, CS is pin 4.
+const int chipSelect = 4;
+
+// Multiplexer select lines, and the analog pin it drives.
+const int selectPin[3] = {5, 6, 7};
+const int muxPin = 0;
+
+// Samples between flushes, the most that is lost on a power failure.
+const unsigned int flushCount = 100;
+
+struct Sample {
+  unsigned long time;
+  byte value[8];
+  int temperature;
+};
+
+// Fields in the order they are stored in Sample.
+const RecordField fields[] = {
+  {"time", RECORD_UINT32},
+  {"ch0", RECORD_UINT8}, {"ch1", RECORD_UINT8},
+  {"ch2", RECORD_UINT8}, {"ch3", RECORD_UINT8},
+  {"ch4", RECORD_UINT8}, {"ch5", RECORD_UINT8},
+  {"ch6", RECORD_UINT8}, {"ch7", RECORD_UINT8},
+  {"temp", RECORD_INT16}
+};
+
+RecordFile recordFile;
+
+void setup()
+{
+  Serial.begin(9600);
+  while (!Serial) {
+    ; // wait for serial port to connect. Needed for Leonardo only
+  }
+  pinMode(SS, OUTPUT);
+  for (int i = 0; i < 3; i++) {
+    pinMode(selectPin[i], OUTPUT);
+  }
+
+  if (!SD.begin(chipSelect)) {
+    Serial.println("Card failed, or not present");
+    while (1) ;
+  }
+  if (!recordFile.begin("muxlog.bin", fields, sizeof(fields) / sizeof(fields[0]))
+    || recordFile.recordSize() != sizeof(Sample)) {
+    Serial.println("error creating muxlog.bin");
+    while (1) ;
+  }
+  Serial.println("logging...");
+}
+
+void loop()
+{
+  Sample s;
+  for (int i = 0; i < 8; i++) {
+    for (int b = 0; b < 3; b++) {
+      digitalWrite(selectPin[b], bitRead(i, b));
+    }
+    delay(5);
+    s.value[i] = analogRead(muxPin) >> 2;
+  }
+  // an LM35 on analog pin 1, in tenths of a degree C
+  s.temperature = analogRead(1) * 4888L / 1000;
+  s.time = millis();
+
+  if (!recordFile.write(&s)
+    || (recordFile.recordCount() % flushCount == 0 && !recordFile.flush())) {
+    Serial.println("write failed");
+    recordFile.end();
+    while (1) ;
+  }
+}
@@ -0,0 +1,37 @@
+/* Minimal Arduino core for building the SD library on a host computer.
+ *
+ * Only what SdFat needs is here: Print, a Serial that writes to stdout,
+ * millis(), pin calls that do nothing and the avr/pgmspace.h macros.
+ * See SdBench.cpp.
+ */
+#ifndef Arduino_h
+#define Arduino_h
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "Print.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0X1
+#define LOW 0X0
+#define INPUT 0X0
+#define OUTPUT 0X1
+
+/** The host card has no chip select pin, Sd2Card's pin calls are ignored. */
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline void pinMode(uint8_t, uint8_t) {}
+
+unsigned long micros(void);
+unsigned long millis(void);
+
+/** Print to standard output. */
+class HardwareSerial : public Print {
+ public:
+  size_t write(uint8_t b) {return putchar(b) == EOF ? 0 : 1;}
+  using Print::write;
+};
+extern HardwareSerial Serial;
+#endif  // Arduino_h
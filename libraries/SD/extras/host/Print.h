@@ -0,0 +1,54 @@
+/* Print class for a host build of the SD library.  See Arduino.h. */
+#ifndef Print_h
+#define Print_h
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEC 10
+#define HEX 16
+
+class Print {
+ public:
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t* buf, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buf++);
+    return n;
+  }
+  size_t write(const char* str) {
+    return write(reinterpret_cast<const uint8_t*>(str), strlen(str));
+  }
+  size_t print(const char* str) {return write(str);}
+  size_t print(char c) {return write(static_cast<uint8_t>(c));}
+  size_t print(int n, int base = DEC) {return print(static_cast<long>(n), base);}
+  size_t print(unsigned int n, int base = DEC) {
+    return print(static_cast<unsigned long>(n), base);
+  }
+  size_t print(long n, int base = DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%ld", n);
+    return write(buf);
+  }
+  size_t print(unsigned long n, int base = DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", n);
+    return write(buf);
+  }
+  size_t print(double n, int digits = 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+  }
+  size_t println(void) {return write("\r\n");}
+  template <typename T> size_t println(T value) {
+    size_t n = print(value);
+    return n + println();
+  }
+  template <typename T> size_t println(T value, int base) {
+    size_t n = print(value, base);
+    return n + println();
+  }
+};
+#endif  // Print_h
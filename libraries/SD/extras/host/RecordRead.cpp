@@ -0,0 +1,189 @@
+/*
+ * Host reader for files written by RecordFile.
+ *
+ * Prints the records of a record file as CSV, one line per record with a
+ * first line of field names, or writes each field to its own file as a
+ * packed little endian array for tools that load columns, such as
+ * numpy.fromfile().  The format is described in RecordFile.cpp.
+ *
+ * Build in this directory with:
+ *
+ *   g++ -O2 -o recordread RecordRead.cpp
+ *
+ * Usage: recordread [-c prefix] file
+ *
+ * With -c the column for field NAME is written to prefixNAME.bin instead
+ * of printing CSV.  Blocks without a sync marker and gaps in the frame
+ * numbers are reported on stderr and skipped.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const uint16_t BLOCK_SIZE = 512;
+static const uint16_t FRAME_HEADER = 8;
+static const uint8_t MAX_FIELDS = 41;
+
+/** Field types, as in SD.h.  The low nibble is the size in bytes. */
+static const uint8_t RECORD_UINT8 = 0X01;
+static const uint8_t RECORD_INT8 = 0X11;
+static const uint8_t RECORD_UINT16 = 0X02;
+static const uint8_t RECORD_INT16 = 0X12;
+static const uint8_t RECORD_UINT32 = 0X04;
+static const uint8_t RECORD_INT32 = 0X14;
+static const uint8_t RECORD_FLOAT = 0X24;
+
+struct field_t {
+  char name[12];
+  uint8_t type;
+  FILE* column;
+};
+
+static field_t field[MAX_FIELDS];
+static uint8_t fieldCount;
+static uint16_t recordSize;
+
+static void error(const char* msg) {
+  fprintf(stderr, "error: %s\n", msg);
+  exit(1);
+}
+
+static uint32_t get16(const uint8_t* p) {
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint8_t knownType(uint8_t type) {
+  return type == RECORD_UINT8 || type == RECORD_INT8
+    || type == RECORD_UINT16 || type == RECORD_INT16
+    || type == RECORD_UINT32 || type == RECORD_INT32
+    || type == RECORD_FLOAT;
+}
+
+static void readSchema(const uint8_t* block) {
+  if (memcmp(block, "SDRH", 4)) error("not a record file");
+  if (block[4] != 1) error("unknown format version");
+  if (get16(block + 8) != BLOCK_SIZE) error("unsupported frame size");
+  fieldCount = block[5];
+  recordSize = get16(block + 6);
+  if (fieldCount == 0 || fieldCount > MAX_FIELDS) error("bad field count");
+  uint16_t size = 0;
+  for (uint8_t i = 0; i < fieldCount; i++) {
+    const uint8_t* entry = block + 16 + 12*i;
+    memcpy(field[i].name, entry, 11);
+    field[i].name[11] = 0;
+    field[i].type = entry[11];
+    if (!knownType(field[i].type)) error("unknown field type");
+    size += field[i].type & 0X0F;
+  }
+  if (size != recordSize || recordSize > BLOCK_SIZE - FRAME_HEADER) {
+    error("bad record size");
+  }
+}
+
+static void printValue(const uint8_t* p, uint8_t type) {
+  float f;
+  switch (type) {
+    case RECORD_UINT8: printf("%u", p[0]); break;
+    case RECORD_INT8: printf("%d", (int8_t)p[0]); break;
+    case RECORD_UINT16: printf("%u", (unsigned)get16(p)); break;
+    case RECORD_INT16: printf("%d", (int16_t)get16(p)); break;
+    case RECORD_UINT32: printf("%lu", (unsigned long)get32(p)); break;
+    case RECORD_INT32: printf("%ld", (long)(int32_t)get32(p)); break;
+    case RECORD_FLOAT: {
+      uint32_t u = get32(p);
+      memcpy(&f, &u, 4);
+      printf("%.9g", f);
+      break;
+    }
+  }
+}
+
+static void outputRecord(const uint8_t* p) {
+  for (uint8_t i = 0; i < fieldCount; i++) {
+    uint8_t n = field[i].type & 0X0F;
+    if (field[i].column) {
+      // the file layout is little endian so the bytes go out as they are
+      if (fwrite(p, 1, n, field[i].column) != n) error("writing column");
+    } else {
+      if (i) putchar(',');
+      printValue(p, field[i].type);
+    }
+    p += n;
+  }
+  if (!field[0].column) putchar('\n');
+}
+
+int main(int argc, char* argv[]) {
+  const char* prefix = 0;
+  int c;
+  while ((c = getopt(argc, argv, "c:")) != -1) {
+    if (c == 'c') {
+      prefix = optarg;
+    } else {
+      optind = argc;
+      break;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-c prefix] file\n", argv[0]);
+    return 1;
+  }
+  FILE* fp = fopen(argv[optind], "rb");
+  if (!fp) error("opening file");
+
+  uint8_t block[BLOCK_SIZE];
+  if (fread(block, 1, BLOCK_SIZE, fp) != BLOCK_SIZE) error("no schema");
+  readSchema(block);
+
+  for (uint8_t i = 0; i < fieldCount; i++) {
+    if (prefix) {
+      char path[FILENAME_MAX];
+      snprintf(path, sizeof(path), "%s%s.bin", prefix, field[i].name);
+      field[i].column = fopen(path, "wb");
+      if (!field[i].column) error("creating column file");
+    } else {
+      printf("%s%s", i ? "," : "", field[i].name);
+    }
+  }
+  if (!prefix) putchar('\n');
+
+  uint32_t blockNumber = 1;
+  uint32_t expect = 0;
+  uint32_t records = 0;
+  uint32_t skipped = 0;
+  size_t n;
+  while ((n = fread(block, 1, BLOCK_SIZE, fp)) > 0) {
+    if (n < FRAME_HEADER || memcmp(block, "SDRF", 4)) {
+      fprintf(stderr, "block %lu: no sync marker, skipped\n",
+        (unsigned long)blockNumber);
+      skipped++;
+    } else {
+      uint32_t frame = get32(block + 4);
+      if (frame != expect) {
+        fprintf(stderr, "block %lu: frame %lu, expected %lu\n",
+          (unsigned long)blockNumber, (unsigned long)frame,
+          (unsigned long)expect);
+      }
+      expect = frame + 1;
+      // only a short last frame holds fewer records than fit
+      for (size_t i = FRAME_HEADER; i + recordSize <= n; i += recordSize) {
+        outputRecord(block + i);
+        records++;
+      }
+    }
+    blockNumber++;
+  }
+  fclose(fp);
+  for (uint8_t i = 0; i < fieldCount; i++) {
+    if (field[i].column && fclose(field[i].column)) error("closing column");
+  }
+  fprintf(stderr, "%lu records, %lu blocks skipped\n",
+    (unsigned long)records, (unsigned long)skipped);
+  return 0;
+}
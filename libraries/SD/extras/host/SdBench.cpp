@@ -0,0 +1,284 @@
+/*
+ * Host benchmark for the SdFat layer of the SD library.
+ *
+ * Runs SdFile operations on a FAT16, FAT32 or exFAT image and prints the card
+ * commands, blocks read and blocks written for each, as counted by
+ * SdSpiCard, with the wall time.  Sd2Card drives SdSpiCard with the same
+ * SPI commands it sends a real card, so the counts compare directly with
+ * a board.  Wall time measures the FAT layer and Sd2Card code on the host.
+ *
+ * Build in this directory with:
+ *
+ *   g++ -O2 -fpack-struct=1 -DARDUINO=100 -DSD_HOST_DEVICE=1 -I. \
+ *     -I../../utility -o sdbench SdBench.cpp ../../utility/Sd*.cpp
+ *
+ * Add -D__AVR_ATmega2560__ to size the caches and tables as on a Mega.
+ *
+ * Usage: sdbench [-f] [-k kbytes] [-m mirror] image
+ *
+ * The image is a FAT or exFAT volume or a card image with an MBR, for
+ * example one made by "mkfs.vfat -C -F 32 card.img 1048576".  It is copied
+ * to RAM and left unchanged unless -f is given, in which case the benchmark
+ * writes to the file.  -k sets the size of the test files, 1024 KB by default.
+ * -m selects SdVolume::setFatMirror(), 0 write, 1 defer or 2 off.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <Arduino.h>
+#include <SdFat.h>
+
+HardwareSerial Serial;
+
+unsigned long micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+unsigned long millis(void) {
+  return micros() / 1000;
+}
+
+static Sd2Card card;
+static SdVolume volume;
+static SdFile root;
+static uint8_t buf[512];
+
+/** Number of files for the open and remove tests. */
+static const uint16_t FILE_COUNT = 100;
+/** Number of contiguous files for the allocContiguous test. */
+static const uint8_t CONTIGUOUS_COUNT = 8;
+/** Number of seeks for the seekSet test. */
+static const uint16_t SEEK_COUNT = 1000;
+/** Number of records for the sync test. */
+static const uint16_t SYNC_COUNT = 100;
+
+static unsigned long startTime;
+
+static void error(const char* msg) {
+  fprintf(stderr, "error: %s, card error 0X%X\n", msg, card.errorCode());
+  exit(1);
+}
+
+static uint8_t pattern(uint32_t pos) {
+  return pos ^ (pos >> 9);
+}
+
+static void fill(uint32_t pos, uint16_t n) {
+  for (uint16_t i = 0; i < n; i++) buf[i] = pattern(pos + i);
+}
+
+static void check(uint32_t pos, uint16_t n) {
+  for (uint16_t i = 0; i < n; i++) {
+    if (buf[i] != pattern(pos + i)) error("read data mismatch");
+  }
+}
+
+static void start(void) {
+  card.hostStatsClear();
+  startTime = micros();
+}
+
+static void report(const char* name, uint32_t ops) {
+  unsigned long usec = micros() - startTime;
+  const sdHostStats_t& s = card.hostStats();
+  printf("%-16s %6lu %7lu %8lu %8lu %7.2f %7.2f %9lu\n", name,
+    (unsigned long)ops, (unsigned long)s.commands,
+    (unsigned long)s.blocksRead, (unsigned long)s.blocksWritten,
+    (double)s.blocksRead/ops, (double)s.blocksWritten/ops, usec);
+}
+
+static void fileName(char* name, uint16_t i) {
+  snprintf(name, 13, "F%05u.DAT", i);
+}
+
+static void writeTest(const char* name, uint32_t size, uint16_t chunk) {
+  SdFile file;
+  char label[20];
+  uint32_t ops = 0;
+  start();
+  if (!file.open(&root, name, O_CREAT | O_WRITE | O_TRUNC)) {
+    error("open for write");
+  }
+  for (uint32_t pos = 0; pos < size; pos += chunk, ops++) {
+    uint16_t n = size - pos < chunk ? size - pos : chunk;
+    fill(pos, n);
+    if (file.write(buf, n) != n) error("write");
+  }
+  if (!file.close()) error("close");
+  snprintf(label, sizeof(label), "write %u", chunk);
+  report(label, ops);
+}
+
+static void readTest(const char* name, uint32_t size, uint16_t chunk) {
+  SdFile file;
+  char label[20];
+  uint32_t ops = 0;
+  start();
+  if (!file.open(&root, name, O_READ)) error("open for read");
+  for (uint32_t pos = 0; pos < size; pos += chunk, ops++) {
+    uint16_t n = size - pos < chunk ? size - pos : chunk;
+    if (file.read(buf, n) != n) error("read");
+    check(pos, n);
+  }
+  file.close();
+  snprintf(label, sizeof(label), "read %u", chunk);
+  report(label, ops);
+}
+
+static void seekTest(const char* name, uint32_t size) {
+  SdFile file;
+  uint32_t seed = 1;
+  if (!file.open(&root, name, O_READ)) error("open for seek");
+  start();
+  for (uint16_t i = 0; i < SEEK_COUNT; i++) {
+    seed = seed * 1103515245UL + 12345;
+    uint32_t pos = (seed >> 8) % size;
+    if (!file.seekSet(pos) || file.read(buf, 1) != 1) error("seekSet");
+    if (buf[0] != pattern(pos)) error("seek data mismatch");
+  }
+  report("seekSet", SEEK_COUNT);
+  file.close();
+}
+
+static void syncTest(void) {
+  SdFile file;
+  if (!file.open(&root, "SYNC.TXT", O_CREAT | O_WRITE | O_TRUNC)) {
+    error("open for sync");
+  }
+  start();
+  for (uint16_t i = 0; i < SYNC_COUNT; i++) {
+    fill(32UL*i, 32);
+    if (file.write(buf, 32) != 32 || !file.sync()) error("sync");
+  }
+  report("sync", SYNC_COUNT);
+  file.close();
+}
+
+static void openTest(void) {
+  SdFile dir;
+  SdFile file;
+  char name[13];
+  if (!dir.makeDir(&root, "BENCH")) error("makeDir");
+  start();
+  for (uint16_t i = 0; i < FILE_COUNT; i++) {
+    fileName(name, i);
+    if (!file.open(&dir, name, O_CREAT | O_EXCL | O_WRITE)) error("create");
+    file.close();
+  }
+  report("open create", FILE_COUNT);
+  start();
+  for (uint16_t i = 0; i < FILE_COUNT; i++) {
+    fileName(name, (37UL*i) % FILE_COUNT);
+    if (!file.open(&dir, name, O_READ)) error("open existing");
+    file.close();
+  }
+  report("open", FILE_COUNT);
+  start();
+  for (uint16_t i = 0; i < FILE_COUNT; i++) {
+    fileName(name, i);
+    if (!SdFile::remove(&dir, name)) error("remove");
+  }
+  report("remove", FILE_COUNT);
+  if (!dir.rmDir()) error("rmDir");
+}
+
+static void contiguousTest(uint32_t size) {
+  SdFile file;
+  char name[13];
+  start();
+  for (uint8_t i = 0; i < CONTIGUOUS_COUNT; i++) {
+    snprintf(name, sizeof(name), "C%u.BIN", i);
+    if (!file.createContiguous(&root, name, size)) error("createContiguous");
+    file.close();
+  }
+  report("allocContiguous", CONTIGUOUS_COUNT);
+  for (uint8_t i = 0; i < CONTIGUOUS_COUNT; i++) {
+    snprintf(name, sizeof(name), "C%u.BIN", i);
+    if (!SdFile::remove(&root, name)) error("remove contiguous");
+  }
+}
+
+static uint8_t loadImage(const char* path, uint8_t** ram, uint32_t* blocks) {
+  FILE* fp = fopen(path, "rb");
+  long size;
+  if (!fp || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 512) return false;
+  *blocks = size >> 9;
+  *ram = static_cast<uint8_t*>(malloc(512UL * *blocks));
+  rewind(fp);
+  if (!*ram || fread(*ram, 512, *blocks, fp) != *blocks) return false;
+  fclose(fp);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  uint8_t useFile = false;
+  uint32_t size = 1024UL*1024;
+  uint8_t mirror = FAT_MIRROR_WRITE;
+  int c;
+  while ((c = getopt(argc, argv, "fk:m:")) != -1) {
+    if (c == 'f') {
+      useFile = true;
+    } else if (c == 'k') {
+      size = 1024UL*strtoul(optarg, 0, 10);
+    } else if (c == 'm') {
+      mirror = atoi(optarg);
+    } else {
+      optind = argc;
+      break;
+    }
+  }
+  if (optind != argc - 1 || size == 0) {
+    fprintf(stderr, "usage: %s [-f] [-k kbytes] [-m mirror] image\n",
+      argv[0]);
+    return 1;
+  }
+  if (useFile) {
+    if (!card.initImage(argv[optind])) error("initImage");
+  } else {
+    uint8_t* ram;
+    uint32_t blocks;
+    if (!loadImage(argv[optind], &ram, &blocks)) error("loading image");
+    if (!card.initRam(ram, blocks)) error("initRam");
+  }
+  if (!volume.init(&card)) error("volume init");
+  if (!root.openRoot(&volume)) error("openRoot");
+  if (!volume.setFatMirror(mirror)) error("setFatMirror");
+  if (volume.fatType() == 64) {
+    printf("exFAT, ");
+  } else {
+    printf("FAT%u, ", volume.fatType());
+  }
+  printf("%lu clusters of %u blocks, %lu KB files\n\n",
+    (unsigned long)volume.clusterCount(),
+    volume.blocksPerCluster(), (unsigned long)(size >> 10));
+  printf("%-16s %6s %7s %8s %8s %7s %7s %9s\n", "operation", "ops",
+    "cmds", "read", "written", "rd/op", "wr/op", "usec");
+
+  start();
+  int32_t free = volume.freeClusterCount();
+  report("freeClusterCount", 1);
+  if (free < 0) error("freeClusterCount");
+
+  writeTest("BENCH1.DAT", size, 512);
+  writeTest("BENCH2.DAT", size, 100);
+  syncTest();
+  readTest("BENCH1.DAT", size, 512);
+  readTest("BENCH2.DAT", size, 100);
+  seekTest("BENCH1.DAT", size);
+  openTest();
+  contiguousTest(size);
+
+  start();
+  if (!SdFile::remove(&root, "BENCH1.DAT")
+    || !SdFile::remove(&root, "BENCH2.DAT")
+    || !SdFile::remove(&root, "SYNC.TXT")) {
+    error("remove");
+  }
+  report("remove large", 3);
+  if (!card.streamStop()) error("streamStop");
+  return 0;
+}
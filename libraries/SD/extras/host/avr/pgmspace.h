@@ -0,0 +1,9 @@
+/* Program memory macros for a host build of the SD library. */
+#ifndef pgmspace_h
+#define pgmspace_h
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*reinterpret_cast<const uint8_t*>(p))
+#define pgm_read_word(p) (*reinterpret_cast<const uint16_t*>(p))
+#endif  // pgmspace_h
@@ -415,4 +415,187 @@ static inline uint8_t DIR_IS_SUBDIR(const dir_t* dir) {
 static inline uint8_t DIR_IS_FILE_OR_SUBDIR(const dir_t* dir) {
   return (dir->attributes & DIR_ATT_VOLUME_ID) == 0;
 }
+//------------------------------------------------------------------------------
+// exFAT structures, from the Microsoft exFAT file system specification
+//------------------------------------------------------------------------------
+/**
+ * \struct exFatBootSector
+ *
+ * \brief Boot sector for an exFAT volume.  64-bit fields are split in
+ * low and high halves.
+ */
+struct exFatBootSector {
+           /** X86 jmp to boot program */
+  uint8_t  jmpToBootCode[3];
+           /** "EXFAT   " */
+  char     fileSystemName[8];
+           /** zero where a FAT boot sector has its BIOS Parameter Block */
+  uint8_t  mustBeZero[53];
+           /** first block of the volume on the device */
+  uint32_t partitionOffsetLow;
+           /** high 32 bits of partitionOffset */
+  uint32_t partitionOffsetHigh;
+           /** size of the volume in blocks */
+  uint32_t volumeLengthLow;
+           /** high 32 bits of volumeLength */
+  uint32_t volumeLengthHigh;
+           /** first block of the FAT relative to the volume */
+  uint32_t fatOffset;
+           /** blocks in one FAT */
+  uint32_t fatLength;
+           /** first block of cluster two relative to the volume */
+  uint32_t clusterHeapOffset;
+           /** clusters in the cluster heap */
+  uint32_t clusterCount;
+           /** first cluster of the root directory */
+  uint32_t rootDirectoryCluster;
+           /** volume serial number */
+  uint32_t volumeSerialNumber;
+           /** file system revision, high byte is major revision */
+  uint16_t fileSystemRevision;
+           /** bit 0 - active FAT, bit 1 - volume dirty, bit 2 - media failure */
+  uint16_t volumeFlags;
+           /** log2 of bytes per sector, 9 for SD cards */
+  uint8_t  bytesPerSectorShift;
+           /** log2 of sectors per cluster */
+  uint8_t  sectorsPerClusterShift;
+           /** 1 or 2 for TexFAT */
+  uint8_t  numberOfFats;
+           /** for int0x13 use value 0X80 for hard drive */
+  uint8_t  driveSelect;
+           /** percent of clusters in use or 0XFF if not known */
+  uint8_t  percentInUse;
+           /** reserved */
+  uint8_t  reserved[7];
+           /** X86 boot code */
+  uint8_t  bootCode[390];
+           /** must be 0X55 */
+  uint8_t  bootSectorSig0;
+           /** must be 0XAA */
+  uint8_t  bootSectorSig1;
+};
+/** Type name for exFatBootSector */
+typedef struct exFatBootSector exfbs_t;
+//------------------------------------------------------------------------------
+/**
+ * \struct exFatFileEntry
+ * \brief exFAT file directory entry, the first entry of a file's entry set.
+ *
+ * Timestamps have the FAT date in the high 16 bits and the FAT time in
+ * the low 16 bits.
+ */
+struct exFatFileEntry {
+           /** EXFAT_TYPE_FILE */
+  uint8_t  type;
+           /** Number of entries that follow in the set. */
+  uint8_t  secondaryCount;
+           /** Checksum of the set, see SdFile::exFatChecksum(). */
+  uint16_t setChecksum;
+           /** DIR_ATT_ bits, the same as for FAT. */
+  uint16_t attributes;
+           /** reserved */
+  uint16_t reserved1;
+           /** Time file was created. */
+  uint32_t createTimestamp;
+           /** Time of last write. */
+  uint32_t modifyTimestamp;
+           /** Time of last access. */
+  uint32_t accessTimestamp;
+           /** Tens of milliseconds to add to createTimestamp. */
+  uint8_t  create10ms;
+           /** Tens of milliseconds to add to modifyTimestamp. */
+  uint8_t  modify10ms;
+           /** UTC offsets, zero if not known. */
+  uint8_t  createUtcOffset;
+           /** UTC offset of modifyTimestamp. */
+  uint8_t  modifyUtcOffset;
+           /** UTC offset of accessTimestamp. */
+  uint8_t  accessUtcOffset;
+           /** reserved */
+  uint8_t  reserved2[7];
+};
+/**
+ * \struct exFatStreamEntry
+ * \brief exFAT stream extension entry, the second entry of a file's set.
+ */
+struct exFatStreamEntry {
+           /** EXFAT_TYPE_STREAM */
+  uint8_t  type;
+           /** EXFAT_FLAG_ bits */
+  uint8_t  flags;
+           /** reserved */
+  uint8_t  reserved1;
+           /** Number of characters in the name. */
+  uint8_t  nameLength;
+           /** Hash of the up-cased name, see SdFile::exFatNameHash(). */
+  uint16_t nameHash;
+           /** reserved */
+  uint16_t reserved2;
+           /** Bytes written, bytes past this read as zero. */
+  uint32_t validLengthLow;
+           /** high 32 bits of validLength */
+  uint32_t validLengthHigh;
+           /** reserved */
+  uint32_t reserved3;
+           /** First cluster of the data, zero if none. */
+  uint32_t firstCluster;
+           /** Bytes allocated, the file size. */
+  uint32_t dataLengthLow;
+           /** high 32 bits of dataLength */
+  uint32_t dataLengthHigh;
+};
+/**
+ * \struct exFatNameEntry
+ * \brief exFAT file name entry, holds 15 characters of a file's name.
+ */
+struct exFatNameEntry {
+           /** EXFAT_TYPE_NAME */
+  uint8_t  type;
+           /** reserved */
+  uint8_t  flags;
+           /** UTF-16 characters of the name. */
+  uint16_t name[15];
+};
+/** Type name for exFatFileEntry */
+typedef struct exFatFileEntry exFile_t;
+/** Type name for exFatStreamEntry */
+typedef struct exFatStreamEntry exStream_t;
+/** Type name for exFatNameEntry */
+typedef struct exFatNameEntry exName_t;
+/**
+ * \struct exFatBitmapEntry
+ * \brief exFAT allocation bitmap directory entry.
+ */
+struct exFatBitmapEntry {
+           /** EXFAT_TYPE_BITMAP */
+  uint8_t  type;
+           /** bit 0 - bitmap for the second FAT */
+  uint8_t  flags;
+           /** reserved */
+  uint8_t  reserved[18];
+           /** First cluster of the bitmap. */
+  uint32_t firstCluster;
+           /** Bytes in the bitmap. */
+  uint32_t dataLengthLow;
+           /** high 32 bits of dataLength */
+  uint32_t dataLengthHigh;
+};
+/** Type name for exFatBitmapEntry */
+typedef struct exFatBitmapEntry exBitmap_t;
+/** exFAT entry type for an allocation bitmap */
+uint8_t const EXFAT_TYPE_BITMAP = 0X81;
+/** exFAT entry type for a file or directory */
+uint8_t const EXFAT_TYPE_FILE = 0X85;
+/** exFAT entry type for a stream extension */
+uint8_t const EXFAT_TYPE_STREAM = 0XC0;
+/** exFAT entry type for a file name */
+uint8_t const EXFAT_TYPE_NAME = 0XC1;
+/** exFAT entry type bit set for an entry in use */
+uint8_t const EXFAT_TYPE_IN_USE = 0X80;
+/** exFAT stream flag, clusters may be allocated */
+uint8_t const EXFAT_FLAG_ALLOCATION_POSSIBLE = 0X01;
+/** exFAT stream flag, clusters are contiguous and the FAT is not used */
+uint8_t const EXFAT_FLAG_NO_FAT_CHAIN = 0X02;
+/** exFAT end of chain value. */
+uint32_t const EXFAT_EOC = 0XFFFFFFFF;
 #endif  // FatStructs_h
@@ -23,153 +23,382 @@
  #include "WProgram.h"
 #endif
 #include "Sd2Card.h"
-//------------------------------------------------------------------------------
-
-static int8_t mosiPin_, misoPin_, clockPin_;
-static volatile uint8_t *mosiport, *clkport, *misoport;
-static uint8_t mosipinmask, clkpinmask, misopinmask;
-
+#if !SD_HOST_DEVICE
 //------------------------------------------------------------------------------
 /** nop to tune soft SPI timing */
 #define nop asm volatile ("nop\n\t")
 
 #ifndef SOFTWARE_SPI
-// functions for hardware SPI
-/** Send a byte to the card */
-static void spiSend(uint8_t data) {
-  if (clockPin_ == -1) {
-    SPDR = data;
+/** transport for init() without pins */
+static SdSpiHardware defaultSpi;
+#else  // SOFTWARE_SPI
+/** transport for init() without pins */
+static SdSpiSoftFixed<SPI_MOSI_PIN, SPI_MISO_PIN, SPI_SCK_PIN> defaultSpi;
+#endif  // SOFTWARE_SPI
+/** transport for init() with pins */
+static SdSpiSoft pinSpi;
+#endif  // !SD_HOST_DEVICE
+//==============================================================================
+// SdSpi
+/** Receive \a n bytes while sending 0XFF. */
+void SdSpi::receive(uint8_t* buf, uint16_t n) {
+  for (uint16_t i = 0; i < n; i++) buf[i] = receive();
+}
+//------------------------------------------------------------------------------
+/** Send \a n bytes. */
+void SdSpi::send(const uint8_t* buf, uint16_t n) {
+  for (uint16_t i = 0; i < n; i++) send(buf[i]);
+}
+//------------------------------------------------------------------------------
+/**
+ * Set the SPI clock rate.  A transport with a fixed rate ignores the call.
+ *
+ * \param[in] sckRateID A value in the range [0, 6].
+ *
+ * \return The value one, true, is returned for success and the value zero,
+ * false, is returned for failure.
+ */
+uint8_t SdSpi::setSckRate(uint8_t sckRateID) {
+  (void)sckRateID;
+  return true;
+}
+#if !SD_HOST_DEVICE
+//==============================================================================
+// SdSpiHardware
+/** Set up the SPI pins and enable the controller at F_CPU/128. */
+void SdSpiHardware::begin(void) {
+  pinMode(MISO_PIN, INPUT);
+  pinMode(MOSI_PIN, OUTPUT);
+  pinMode(SCK_PIN, OUTPUT);
+  // SS must be in output mode even it is not chip select
+  pinMode(SS_PIN, OUTPUT);
+  digitalWrite(SS_PIN, HIGH); // disable any SPI device using hardware SS pin
+  // Enable SPI, Master, clock rate f_osc/128
+  SPCR = (1 << SPE) | (1 << MSTR) | (1 << SPR1) | (1 << SPR0);
+  // clear double speed
+  SPSR &= ~(1 << SPI2X);
+}
+//------------------------------------------------------------------------------
+/** Receive \a n bytes while sending 0XFF. */
+void SdSpiHardware::receive(uint8_t* buf, uint16_t n) {
+  if (n-- == 0) return;
+  // start first spi transfer
+  SPDR = 0XFF;
+  // start the next transfer as soon as each byte arrives
+  for (uint16_t i = 0; i < n; i++) {
+    while (!(SPSR & (1 << SPIF)));
+    uint8_t b = SPDR;
+    SPDR = 0XFF;
+    buf[i] = b;
+  }
+  // wait for last byte
+  while (!(SPSR & (1 << SPIF)));
+  buf[n] = SPDR;
+}
+//------------------------------------------------------------------------------
+/** Send \a n bytes. */
+void SdSpiHardware::send(const uint8_t* buf, uint16_t n) {
+  if (n == 0) return;
+  SPDR = buf[0];
+  // fetch the next byte while the last one is shifted out
+  for (uint16_t i = 1; i < n; i++) {
+    uint8_t b = buf[i];
     while (!(SPSR & (1 << SPIF)));
+    SPDR = b;
+  }
+  // wait for last byte
+  while (!(SPSR & (1 << SPIF)));
+}
+//------------------------------------------------------------------------------
+/**
+ * Set the SPI clock rate to F_CPU/pow(2, 1 + sckRateID).
+ *
+ * \param[in] sckRateID A value in the range [0, 6].
+ *
+ * \return The value one, true, is returned.
+ */
+uint8_t SdSpiHardware::setSckRate(uint8_t sckRateID) {
+  // see avr processor datasheet for SPI register bit definitions
+  if ((sckRateID & 1) || sckRateID == 6) {
+    SPSR &= ~(1 << SPI2X);
   } else {
-    cli();
-    // Fast SPI bitbang swiped from LPD8806 library
-    for (uint8_t i = 0; i < 8; i++) {
-      *clkport &= ~clkpinmask;
-      if (data & 0x80)
-	*mosiport |= mosipinmask;
-      else
-	*mosiport &= ~mosipinmask;
-      *clkport |=  clkpinmask;
-      data <<= 1;
-    }
-    nop;nop;nop;nop;
-    *clkport &= ~clkpinmask;
-    
-    sei();
+    SPSR |= (1 << SPI2X);
   }
+  SPCR &= ~((1 <<SPR1) | (1 << SPR0));
+  SPCR |= (sckRateID & 4 ? (1 << SPR1) : 0)
+    | (sckRateID & 2 ? (1 << SPR0) : 0);
+  return true;
 }
-
-/** Receive a byte from the card */
-static  uint8_t spiRec(void) {
-  if (clockPin_ == -1) {
-    spiSend(0XFF);
-    return SPDR;
+//==============================================================================
+// SdSpiSoft
+//
+// Fast SPI bitbang swiped from LPD8806 library.  The port registers and
+// masks are copied to locals for each call so a block is bit-banged from
+// registers with only one call for the block.  The bit loops are unrolled.
+//
+/** pins of an SdSpiSoft copied to registers */
+struct softPins_t {
+  volatile uint8_t* mosiPort;
+  volatile uint8_t* misoPort;
+  volatile uint8_t* sckPort;
+  uint8_t mosiMask;
+  uint8_t misoMask;
+  uint8_t sckMask;
+};
+//------------------------------------------------------------------------------
+static inline __attribute__((always_inline))
+  uint8_t softReceiveBit(const softPins_t& p, uint8_t data) {
+  *p.sckPort |= p.sckMask;
+  data <<= 1;
+  if (*p.misoPort & p.misoMask) data |= 1;
+  *p.sckPort &= ~p.sckMask;
+  // adjust so SCK is nice
+  nop;
+  nop;
+  return data;
+}
+//------------------------------------------------------------------------------
+static inline __attribute__((always_inline))
+  void softSendBit(const softPins_t& p, uint8_t data, uint8_t mask) {
+  *p.sckPort &= ~p.sckMask;
+  if (data & mask) {
+    *p.mosiPort |= p.mosiMask;
   } else {
+    *p.mosiPort &= ~p.mosiMask;
+  }
+  *p.sckPort |= p.sckMask;
+}
+//------------------------------------------------------------------------------
+/** Set up the pins chosen by setPins(). */
+void SdSpiSoft::begin(void) {
+  pinMode(misoPin_, INPUT);
+  pinMode(mosiPin_, OUTPUT);
+  pinMode(sckPin_, OUTPUT);
+  digitalWrite(sckPin_, LOW);
+}
+//------------------------------------------------------------------------------
+/** \return The byte received while sending 0XFF. */
+uint8_t SdSpiSoft::receive(void) {
+  uint8_t data;
+  SdSpiSoft::receive(&data, 1);
+  return data;
+}
+//------------------------------------------------------------------------------
+/** Receive \a n bytes while sending 0XFF. */
+void SdSpiSoft::receive(uint8_t* buf, uint16_t n) {
+  softPins_t p = {mosiPort_, misoPort_, sckPort_,
+    mosiMask_, misoMask_, sckMask_};
+  for (uint16_t i = 0; i < n; i++) {
     uint8_t data = 0;
-    // no interrupts during byte receive - about 8 us
+    // no interrupts during byte receive, the ports are read-modify-write
+    uint8_t oldSREG = SREG;
     cli();
     // output pin high - like sending 0XFF
-    *mosiport |= mosipinmask;
-    
-    for (uint8_t i = 0; i < 8; i++) {
-      *clkport |=  clkpinmask;
-      data <<= 1;
-      
-      //if (fastDigitalRead(SPI_MISO_PIN)) data |= 1;
-      if ((*misoport) & misopinmask)  data |= 1;
-      
-      *clkport &=  ~clkpinmask;
-      
-      // adjust so SCK is nice
-      nop;
-      nop;
-    }
-    // enable interrupts
-    sei();
-    return data;
+    *p.mosiPort |= p.mosiMask;
+    data = softReceiveBit(p, data);
+    data = softReceiveBit(p, data);
+    data = softReceiveBit(p, data);
+    data = softReceiveBit(p, data);
+    data = softReceiveBit(p, data);
+    data = softReceiveBit(p, data);
+    data = softReceiveBit(p, data);
+    data = softReceiveBit(p, data);
+    SREG = oldSREG;
+    buf[i] = data;
   }
 }
-
-
-#else  // SOFTWARE_SPI
-
 //------------------------------------------------------------------------------
-/** Soft SPI receive */
-uint8_t spiRec(void) {
-  uint8_t data = 0;
-  // no interrupts during byte receive - about 8 us
-  cli();
-  // output pin high - like sending 0XFF
-  fastDigitalWrite(SPI_MOSI_PIN, HIGH);
-
-  for (uint8_t i = 0; i < 8; i++) {
-    fastDigitalWrite(SPI_SCK_PIN, HIGH);
-
-    // adjust so SCK is nice
-    nop;
-    nop;
-
-    data <<= 1;
-
-    if (fastDigitalRead(SPI_MISO_PIN)) data |= 1;
-
-    fastDigitalWrite(SPI_SCK_PIN, LOW);
+/** Send a byte. */
+void SdSpiSoft::send(uint8_t data) {
+  SdSpiSoft::send(&data, 1);
+}
+//------------------------------------------------------------------------------
+/** Send \a n bytes. */
+void SdSpiSoft::send(const uint8_t* buf, uint16_t n) {
+  softPins_t p = {mosiPort_, misoPort_, sckPort_,
+    mosiMask_, misoMask_, sckMask_};
+  for (uint16_t i = 0; i < n; i++) {
+    uint8_t data = buf[i];
+    // no interrupts during byte send, the ports are read-modify-write
+    uint8_t oldSREG = SREG;
+    cli();
+    softSendBit(p, data, 0X80);
+    softSendBit(p, data, 0X40);
+    softSendBit(p, data, 0X20);
+    softSendBit(p, data, 0X10);
+    softSendBit(p, data, 0X08);
+    softSendBit(p, data, 0X04);
+    softSendBit(p, data, 0X02);
+    softSendBit(p, data, 0X01);
+    // hold SCK high for a few ns
+    nop;nop;nop;nop;
+    *p.sckPort &= ~p.sckMask;
+    SREG = oldSREG;
   }
-  // enable interrupts
-  sei();
-  return data;
 }
 //------------------------------------------------------------------------------
-/** Soft SPI send */
-void spiSend(uint8_t data) {
-  // no interrupts during byte send - about 8 us
-  cli();
-  for (uint8_t i = 0; i < 8; i++) {
-    fastDigitalWrite(SPI_SCK_PIN, LOW);
-
-    fastDigitalWrite(SPI_MOSI_PIN, data & 0X80);
-
-    data <<= 1;
-
-    fastDigitalWrite(SPI_SCK_PIN, HIGH);
+/**
+ * Choose the SPI pins.  Call begin() to set their modes.
+ *
+ * \param[in] mosiPin Master Out Slave In pin number.
+ * \param[in] misoPin Master In Slave Out pin number.
+ * \param[in] sckPin Clock pin number.
+ */
+void SdSpiSoft::setPins(uint8_t mosiPin, uint8_t misoPin, uint8_t sckPin) {
+  mosiPin_ = mosiPin;
+  misoPin_ = misoPin;
+  sckPin_ = sckPin;
+  mosiPort_ = portOutputRegister(digitalPinToPort(mosiPin));
+  mosiMask_ = digitalPinToBitMask(mosiPin);
+  misoPort_ = portInputRegister(digitalPinToPort(misoPin));
+  misoMask_ = digitalPinToBitMask(misoPin);
+  sckPort_ = portOutputRegister(digitalPinToPort(sckPin));
+  sckMask_ = digitalPinToBitMask(sckPin);
+}
+#endif  // !SD_HOST_DEVICE
+//==============================================================================
+// CRC7 for commands and CRC16 for data blocks, see the SD physical layer
+// spec.  Both start from zero.
+#if SD_CRC_TABLES
+/** CRC7 of each byte value, polynomial x^7 + x^3 + 1, in the low 7 bits */
+static const uint8_t crc7Table[256] PROGMEM = {
+  0X00, 0X09, 0X12, 0X1B, 0X24, 0X2D, 0X36, 0X3F, 0X48, 0X41, 0X5A, 0X53,
+  0X6C, 0X65, 0X7E, 0X77, 0X19, 0X10, 0X0B, 0X02, 0X3D, 0X34, 0X2F, 0X26,
+  0X51, 0X58, 0X43, 0X4A, 0X75, 0X7C, 0X67, 0X6E, 0X32, 0X3B, 0X20, 0X29,
+  0X16, 0X1F, 0X04, 0X0D, 0X7A, 0X73, 0X68, 0X61, 0X5E, 0X57, 0X4C, 0X45,
+  0X2B, 0X22, 0X39, 0X30, 0X0F, 0X06, 0X1D, 0X14, 0X63, 0X6A, 0X71, 0X78,
+  0X47, 0X4E, 0X55, 0X5C, 0X64, 0X6D, 0X76, 0X7F, 0X40, 0X49, 0X52, 0X5B,
+  0X2C, 0X25, 0X3E, 0X37, 0X08, 0X01, 0X1A, 0X13, 0X7D, 0X74, 0X6F, 0X66,
+  0X59, 0X50, 0X4B, 0X42, 0X35, 0X3C, 0X27, 0X2E, 0X11, 0X18, 0X03, 0X0A,
+  0X56, 0X5F, 0X44, 0X4D, 0X72, 0X7B, 0X60, 0X69, 0X1E, 0X17, 0X0C, 0X05,
+  0X3A, 0X33, 0X28, 0X21, 0X4F, 0X46, 0X5D, 0X54, 0X6B, 0X62, 0X79, 0X70,
+  0X07, 0X0E, 0X15, 0X1C, 0X23, 0X2A, 0X31, 0X38, 0X41, 0X48, 0X53, 0X5A,
+  0X65, 0X6C, 0X77, 0X7E, 0X09, 0X00, 0X1B, 0X12, 0X2D, 0X24, 0X3F, 0X36,
+  0X58, 0X51, 0X4A, 0X43, 0X7C, 0X75, 0X6E, 0X67, 0X10, 0X19, 0X02, 0X0B,
+  0X34, 0X3D, 0X26, 0X2F, 0X73, 0X7A, 0X61, 0X68, 0X57, 0X5E, 0X45, 0X4C,
+  0X3B, 0X32, 0X29, 0X20, 0X1F, 0X16, 0X0D, 0X04, 0X6A, 0X63, 0X78, 0X71,
+  0X4E, 0X47, 0X5C, 0X55, 0X22, 0X2B, 0X30, 0X39, 0X06, 0X0F, 0X14, 0X1D,
+  0X25, 0X2C, 0X37, 0X3E, 0X01, 0X08, 0X13, 0X1A, 0X6D, 0X64, 0X7F, 0X76,
+  0X49, 0X40, 0X5B, 0X52, 0X3C, 0X35, 0X2E, 0X27, 0X18, 0X11, 0X0A, 0X03,
+  0X74, 0X7D, 0X66, 0X6F, 0X50, 0X59, 0X42, 0X4B, 0X17, 0X1E, 0X05, 0X0C,
+  0X33, 0X3A, 0X21, 0X28, 0X5F, 0X56, 0X4D, 0X44, 0X7B, 0X72, 0X69, 0X60,
+  0X0E, 0X07, 0X1C, 0X15, 0X2A, 0X23, 0X38, 0X31, 0X46, 0X4F, 0X54, 0X5D,
+  0X62, 0X6B, 0X70, 0X79
+};
+/** CRC16 of each byte value, polynomial x^16 + x^12 + x^5 + 1 */
+static const uint16_t crc16Table[256] PROGMEM = {
+  0X0000, 0X1021, 0X2042, 0X3063, 0X4084, 0X50A5, 0X60C6, 0X70E7,
+  0X8108, 0X9129, 0XA14A, 0XB16B, 0XC18C, 0XD1AD, 0XE1CE, 0XF1EF,
+  0X1231, 0X0210, 0X3273, 0X2252, 0X52B5, 0X4294, 0X72F7, 0X62D6,
+  0X9339, 0X8318, 0XB37B, 0XA35A, 0XD3BD, 0XC39C, 0XF3FF, 0XE3DE,
+  0X2462, 0X3443, 0X0420, 0X1401, 0X64E6, 0X74C7, 0X44A4, 0X5485,
+  0XA56A, 0XB54B, 0X8528, 0X9509, 0XE5EE, 0XF5CF, 0XC5AC, 0XD58D,
+  0X3653, 0X2672, 0X1611, 0X0630, 0X76D7, 0X66F6, 0X5695, 0X46B4,
+  0XB75B, 0XA77A, 0X9719, 0X8738, 0XF7DF, 0XE7FE, 0XD79D, 0XC7BC,
+  0X48C4, 0X58E5, 0X6886, 0X78A7, 0X0840, 0X1861, 0X2802, 0X3823,
+  0XC9CC, 0XD9ED, 0XE98E, 0XF9AF, 0X8948, 0X9969, 0XA90A, 0XB92B,
+  0X5AF5, 0X4AD4, 0X7AB7, 0X6A96, 0X1A71, 0X0A50, 0X3A33, 0X2A12,
+  0XDBFD, 0XCBDC, 0XFBBF, 0XEB9E, 0X9B79, 0X8B58, 0XBB3B, 0XAB1A,
+  0X6CA6, 0X7C87, 0X4CE4, 0X5CC5, 0X2C22, 0X3C03, 0X0C60, 0X1C41,
+  0XEDAE, 0XFD8F, 0XCDEC, 0XDDCD, 0XAD2A, 0XBD0B, 0X8D68, 0X9D49,
+  0X7E97, 0X6EB6, 0X5ED5, 0X4EF4, 0X3E13, 0X2E32, 0X1E51, 0X0E70,
+  0XFF9F, 0XEFBE, 0XDFDD, 0XCFFC, 0XBF1B, 0XAF3A, 0X9F59, 0X8F78,
+  0X9188, 0X81A9, 0XB1CA, 0XA1EB, 0XD10C, 0XC12D, 0XF14E, 0XE16F,
+  0X1080, 0X00A1, 0X30C2, 0X20E3, 0X5004, 0X4025, 0X7046, 0X6067,
+  0X83B9, 0X9398, 0XA3FB, 0XB3DA, 0XC33D, 0XD31C, 0XE37F, 0XF35E,
+  0X02B1, 0X1290, 0X22F3, 0X32D2, 0X4235, 0X5214, 0X6277, 0X7256,
+  0XB5EA, 0XA5CB, 0X95A8, 0X8589, 0XF56E, 0XE54F, 0XD52C, 0XC50D,
+  0X34E2, 0X24C3, 0X14A0, 0X0481, 0X7466, 0X6447, 0X5424, 0X4405,
+  0XA7DB, 0XB7FA, 0X8799, 0X97B8, 0XE75F, 0XF77E, 0XC71D, 0XD73C,
+  0X26D3, 0X36F2, 0X0691, 0X16B0, 0X6657, 0X7676, 0X4615, 0X5634,
+  0XD94C, 0XC96D, 0XF90E, 0XE92F, 0X99C8, 0X89E9, 0XB98A, 0XA9AB,
+  0X5844, 0X4865, 0X7806, 0X6827, 0X18C0, 0X08E1, 0X3882, 0X28A3,
+  0XCB7D, 0XDB5C, 0XEB3F, 0XFB1E, 0X8BF9, 0X9BD8, 0XABBB, 0XBB9A,
+  0X4A75, 0X5A54, 0X6A37, 0X7A16, 0X0AF1, 0X1AD0, 0X2AB3, 0X3A92,
+  0XFD2E, 0XED0F, 0XDD6C, 0XCD4D, 0XBDAA, 0XAD8B, 0X9DE8, 0X8DC9,
+  0X7C26, 0X6C07, 0X5C64, 0X4C45, 0X3CA2, 0X2C83, 0X1CE0, 0X0CC1,
+  0XEF1F, 0XFF3E, 0XCF5D, 0XDF7C, 0XAF9B, 0XBFBA, 0X8FD9, 0X9FF8,
+  0X6E17, 0X7E36, 0X4E55, 0X5E74, 0X2E93, 0X3EB2, 0X0ED1, 0X1EF0
+};
+//------------------------------------------------------------------------------
+/** \return The CRC7 of \a n bytes with the end bit set, as sent. */
+static uint8_t CRC7(const uint8_t* data, uint8_t n) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    crc = pgm_read_byte(&crc7Table[(crc << 1) ^ data[i]]);
   }
-  // hold SCK high for a few ns
-  nop;
-  nop;
-  nop;
-  nop;
-
-  fastDigitalWrite(SPI_SCK_PIN, LOW);
-  // enable interrupts
-  sei();
+  return (crc << 1) | 1;
 }
-#endif  // SOFTWARE_SPI
+//------------------------------------------------------------------------------
+/** \return \a crc updated with \a n bytes. */
+static uint16_t CRC16(uint16_t crc, const uint8_t* data, uint16_t n) {
+  for (uint16_t i = 0; i < n; i++) {
+    crc = (crc << 8) ^ pgm_read_word(&crc16Table[(crc >> 8) ^ data[i]]);
+  }
+  return crc;
+}
+#else  // SD_CRC_TABLES
+//------------------------------------------------------------------------------
+/** \return The CRC7 of \a n bytes with the end bit set, as sent. */
+static uint8_t CRC7(const uint8_t* data, uint8_t n) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    uint8_t d = data[i];
+    for (uint8_t j = 0; j < 8; j++) {
+      crc <<= 1;
+      if ((d ^ crc) & 0X80) crc ^= 0X09;
+      d <<= 1;
+    }
+  }
+  return (crc << 1) | 1;
+}
+//------------------------------------------------------------------------------
+/** \return \a crc updated with \a n bytes. */
+static uint16_t CRC16(uint16_t crc, const uint8_t* data, uint16_t n) {
+  // CRC16 code via Scott Dattalo www.dattalo.com
+  for (uint16_t i = 0; i < n; i++) {
+    uint8_t x = (crc >> 8) ^ data[i];
+    x ^= x >> 4;
+    crc = (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ x;
+  }
+  return crc;
+}
+#endif  // SD_CRC_TABLES
+//==============================================================================
+// Sd2Card
 //------------------------------------------------------------------------------
 // send command and return error code.  Return zero for OK
 uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
   // end read if in partialBlockRead mode
   readEnd();
 
+  // end a multiple block transfer left open by streamRead() or streamWrite()
+  if (streamState_) streamStop();
+
   // select card
   chipSelectLow();
 
-  // wait up to 300 ms if busy
-  waitNotBusy(300);
+  // wait up to 300 ms if busy - CMD12 is sent while data is streaming
+  if (cmd != CMD12) waitNotBusy(300);
 
-  // send command
-  spiSend(cmd | 0x40);
-
-  // send argument
-  for (int8_t s = 24; s >= 0; s -= 8) spiSend(arg >> s);
+  // command, argument and CRC
+  uint8_t buf[6];
+  buf[0] = cmd | 0x40;
+  for (uint8_t i = 1; i < 5; i++) buf[i] = arg >> (32 - 8*i);
+  if (crcMode_) {
+    buf[5] = CRC7(buf, 5);
+  } else {
+    buf[5] = 0XFF;
+    if (cmd == CMD0) buf[5] = 0X95;  // correct crc for CMD0 with arg 0
+    if (cmd == CMD8) buf[5] = 0X87;  // correct crc for CMD8 with arg 0X1AA
+  }
+  spi_->send(buf, 6);
 
-  // send CRC
-  uint8_t crc = 0XFF;
-  if (cmd == CMD0) crc = 0X95;  // correct crc for CMD0 with arg 0
-  if (cmd == CMD8) crc = 0X87;  // correct crc for CMD8 with arg 0X1AA
-  spiSend(crc);
+  // skip stuff byte for stop read
+  if (cmd == CMD12) spi_->receive();
 
   // wait for response
-  for (uint8_t i = 0; ((status_ = spiRec()) & 0X80) && i != 0XFF; i++);
+  for (uint8_t i = 0; ((status_ = spi_->receive()) & 0X80) && i != 0XFF; i++);
   return status_;
 }
 //------------------------------------------------------------------------------
@@ -262,18 +491,49 @@ uint8_t Sd2Card::eraseSingleBlockEnable(void) {
  *
  * \param[in] sckRateID SPI clock rate selector. See setSckRate().
  * \param[in] chipSelectPin SD chip select pin number.
+ * \param[in] mosiPin Master Out Slave In pin for software SPI.
+ * \param[in] misoPin Master In Slave Out pin for software SPI.
+ * \param[in] clockPin Clock pin for software SPI, or -1 to use the
+ * default transport for the board.
+ *
+ * A host build ignores the pins and uses the card attached by initRam()
+ * or initImage().
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.  The reason for failure
  * can be determined by calling errorCode() and errorData().
  */
 uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin, int8_t misoPin, int8_t clockPin) {
+#if SD_HOST_DEVICE
+  (void)mosiPin;
+  (void)misoPin;
+  (void)clockPin;
+  return init(sckRateID, chipSelectPin, &hostCard_);
+#else  // SD_HOST_DEVICE
+  if (clockPin == -1) return init(sckRateID, chipSelectPin, &defaultSpi);
+  // use slow bitbang mode
+  pinSpi.setPins(mosiPin, misoPin, clockPin);
+  return init(sckRateID, chipSelectPin, &pinSpi);
+#endif  // SD_HOST_DEVICE
+}
+//------------------------------------------------------------------------------
+/**
+ * Initialize an SD flash memory card on a given SPI transport.
+ *
+ * \param[in] sckRateID SPI clock rate selector. See setSckRate().
+ * \param[in] chipSelectPin SD chip select pin number.
+ * \param[in] spi The transport, which must stay valid while the card is used.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.  The reason for failure
+ * can be determined by calling errorCode() and errorData().
+ */
+uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, SdSpi* spi) {
 
-  writeCRC_ = errorCode_ = inBlock_ = partialBlockRead_ = type_ = 0;
+  errorCode_ = inBlock_ = partialBlockRead_ = type_ = 0;
+  streamState_ = STREAM_IDLE;
   chipSelectPin_ = chipSelectPin;
-  mosiPin_ = mosiPin;
-  misoPin_ = misoPin;
-  clockPin_ = clockPin;
+  spi_ = spi;
   // 16-bit init start time allows over a minute
   uint16_t t0 = (uint16_t)millis();
   uint32_t arg;
@@ -281,36 +541,10 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin,
   // set pin modes
   pinMode(chipSelectPin_, OUTPUT);
   chipSelectHigh();
-
-  if (clockPin != -1) {
-    // use slow bitbang mode
-    pinMode(misoPin_, INPUT);
-    pinMode(mosiPin_, OUTPUT);
-    pinMode(clockPin_, OUTPUT);
-    clkport     = portOutputRegister(digitalPinToPort(clockPin_));
-    clkpinmask  = digitalPinToBitMask(clockPin_);
-    mosiport    = portOutputRegister(digitalPinToPort(mosiPin_));
-    mosipinmask = digitalPinToBitMask(mosiPin_);
-    misoport    = portInputRegister(digitalPinToPort(misoPin_));
-    misopinmask = digitalPinToBitMask(misoPin_);
-  } else {
-    pinMode(SPI_MISO_PIN, INPUT);
-    pinMode(SPI_MOSI_PIN, OUTPUT);
-    pinMode(SPI_SCK_PIN, OUTPUT);
-
-#ifndef SOFTWARE_SPI
-    // SS must be in output mode even it is not chip select
-    pinMode(SS_PIN, OUTPUT);
-    digitalWrite(SS_PIN, HIGH); // disable any SPI device using hardware SS pin
-    // Enable SPI, Master, clock rate f_osc/128
-    SPCR = (1 << SPE) | (1 << MSTR) | (1 << SPR1) | (1 << SPR0);
-    // clear double speed
-    SPSR &= ~(1 << SPI2X);
-#endif  // SOFTWARE_SPI
-  }
+  spi_->begin();
 
   // must supply min of 74 clock cycles with CS high.
-  for (uint8_t i = 0; i < 10; i++) spiSend(0XFF);
+  for (uint8_t i = 0; i < 10; i++) spi_->send(0XFF);
 
   chipSelectLow();
 
@@ -326,7 +560,7 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin,
     type(SD_CARD_TYPE_SD1);
   } else {
     // only need last byte of r7 response
-    for (uint8_t i = 0; i < 4; i++) status_ = spiRec();
+    for (uint8_t i = 0; i < 4; i++) status_ = spi_->receive();
     if (status_ != 0XAA) {
       error(SD_CARD_ERROR_CMD8);
       goto fail;
@@ -349,20 +583,17 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin,
       error(SD_CARD_ERROR_CMD58);
       goto fail;
     }
-    if ((spiRec() & 0XC0) == 0XC0) type(SD_CARD_TYPE_SDHC);
+    if ((spi_->receive() & 0XC0) == 0XC0) type(SD_CARD_TYPE_SDHC);
     // discard rest of ocr - contains allowed voltage range
-    for (uint8_t i = 0; i < 3; i++) spiRec();
+    for (uint8_t i = 0; i < 3; i++) spi_->receive();
+  }
+  // CMD0 turned CRC checking off, restore the mode set by enableCRC()
+  if (crcMode_ && cardCommand(CMD59, 1)) {
+    error(SD_CARD_ERROR_CMD59);
+    goto fail;
   }
   chipSelectHigh();
-
-#ifndef SOFTWARE_SPI
-  if (clockPin_ == -1)
-    return setSckRate(sckRateID);
-  else 
-    return true;
-#else  // SOFTWARE_SPI
-  return true;
-#endif  // SOFTWARE_SPI
+  return setSckRate(sckRateID);
 
  fail:
   chipSelectHigh();
@@ -403,6 +634,10 @@ uint8_t Sd2Card::readBlock(uint32_t block, uint8_t* dst) {
 /**
  * Read part of a 512 byte block from an SD card.
  *
+ * With CRC enabled the block CRC is checked by the call that reaches the
+ * end of the block.  In partial block read mode earlier calls have
+ * already returned their data.
+ *
  * \param[in] block Logical block to be read.
  * \param[in] offset Number of bytes to skip at start of block
  * \param[out] dst Pointer to the location that will receive the data.
@@ -412,7 +647,6 @@ uint8_t Sd2Card::readBlock(uint32_t block, uint8_t* dst) {
  */
 uint8_t Sd2Card::readData(uint32_t block,
         uint16_t offset, uint16_t count, uint8_t* dst) {
-  uint16_t n;
   if (count == 0) return true;
   if ((count + offset) > 512) {
     goto fail;
@@ -430,44 +664,22 @@ uint8_t Sd2Card::readData(uint32_t block,
     }
     offset_ = 0;
     inBlock_ = 1;
+    crc_ = 0;
   }
 
-#ifdef OPTIMIZE_HARDWARE_SPI
-  // start first spi transfer
-  SPDR = 0XFF;
-
   // skip data before offset
   for (;offset_ < offset; offset_++) {
-    while (!(SPSR & (1 << SPIF)));
-    SPDR = 0XFF;
+    uint8_t b = spi_->receive();
+    if (crcMode_) crc_ = CRC16(crc_, &b, 1);
   }
   // transfer data
-  n = count - 1;
-  for (uint16_t i = 0; i < n; i++) {
-    while (!(SPSR & (1 << SPIF)));
-    dst[i] = SPDR;
-    SPDR = 0XFF;
-  }
-  // wait for last byte
-  while (!(SPSR & (1 << SPIF)));
-  dst[n] = SPDR;
-
-#else  // OPTIMIZE_HARDWARE_SPI
-
-  // skip data before offset
-  for (;offset_ < offset; offset_++) {
-    spiRec();
-  }
-  // transfer data
-  for (uint16_t i = 0; i < count; i++) {
-    dst[i] = spiRec();
-  }
-#endif  // OPTIMIZE_HARDWARE_SPI
+  spi_->receive(dst, count);
+  if (crcMode_) crc_ = CRC16(crc_, dst, count);
 
   offset_ += count;
   if (!partialBlockRead_ || offset_ >= 512) {
     // read rest of data, checksum and set chip select high
-    readEnd();
+    if (!readRest()) goto fail;
   }
   return true;
 
@@ -479,36 +691,48 @@ uint8_t Sd2Card::readData(uint32_t block,
 /** Skip remaining data in a block when in partial block read mode. */
 void Sd2Card::readEnd(void) {
   if (inBlock_) {
-      // skip data and crc
-#ifdef OPTIMIZE_HARDWARE_SPI
-    // optimize skip for hardware
-    SPDR = 0XFF;
-    while (offset_++ < 513) {
-      while (!(SPSR & (1 << SPIF)));
-      SPDR = 0XFF;
-    }
-    // Wait for last CRC byte
-    while (!(SPSR & (1 << SPIF)));
-#else  // OPTIMIZE_HARDWARE_SPI
-    while (offset_++ < 514) spiRec();
-#endif  // OPTIMIZE_HARDWARE_SPI
+    // skip data and crc
+    while (offset_++ < 514) spi_->receive();
     chipSelectHigh();
     inBlock_ = 0;
   }
 }
 //------------------------------------------------------------------------------
+/** Read the rest of a block and its CRC, check the CRC if enabled. */
+uint8_t Sd2Card::readRest(void) {
+  uint16_t crc;
+  for (; offset_ < 512; offset_++) {
+    uint8_t b = spi_->receive();
+    if (crcMode_) crc_ = CRC16(crc_, &b, 1);
+  }
+  crc = spi_->receive() << 8;
+  crc |= spi_->receive();
+  chipSelectHigh();
+  inBlock_ = 0;
+  if (crcMode_ && crc != crc_) {
+    error(SD_CARD_ERROR_READ_CRC);
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 /** read CID or CSR register */
 uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
   uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
+  uint16_t crc;
   if (cardCommand(cmd, 0)) {
     error(SD_CARD_ERROR_READ_REG);
     goto fail;
   }
   if (!waitStartBlock()) goto fail;
   // transfer data
-  for (uint16_t i = 0; i < 16; i++) dst[i] = spiRec();
-  spiRec();  // get first crc byte
-  spiRec();  // get second crc byte
+  spi_->receive(dst, 16);
+  crc = spi_->receive() << 8;  // get first crc byte
+  crc |= spi_->receive();  // get second crc byte
+  if (crcMode_ && crc != CRC16(0, dst, 16)) {
+    error(SD_CARD_ERROR_READ_CRC);
+    goto fail;
+  }
   chipSelectHigh();
   return true;
 
@@ -524,33 +748,145 @@ uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
  *
  * The SPI clock will be set to F_CPU/pow(2, 1 + sckRateID). The maximum
  * SPI rate is F_CPU/2 for \a sckRateID = 0 and the minimum rate is F_CPU/128
- * for \a scsRateID = 6.
+ * for \a scsRateID = 6.  Software SPI transports run at a fixed rate.
  *
  * \return The value one, true, is returned for success and the value zero,
  * false, is returned for an invalid value of \a sckRateID.
  */
 uint8_t Sd2Card::setSckRate(uint8_t sckRateID) {
-  if (sckRateID > 6) {
+  if (sckRateID > 6 || !spi_) {
     error(SD_CARD_ERROR_SCK_RATE);
     return false;
   }
-  // see avr processor datasheet for SPI register bit definitions
-  if ((sckRateID & 1) || sckRateID == 6) {
-    SPSR &= ~(1 << SPI2X);
+  return spi_->setSckRate(sckRateID);
+}
+//------------------------------------------------------------------------------
+/**
+ * Read a 512 byte block as part of a streamed multiple block read.
+ *
+ * A read multiple blocks sequence is started at \a blockNumber and left
+ * open so the next call for the following block only waits for the data
+ * token.  Any other card command or streamStop() ends the sequence.
+ * Chip select is raised between blocks so the SPI bus may be shared.
+ *
+ * \param[in] blockNumber Logical block to be read.
+ * \param[out] dst Pointer to the location that will receive the data.
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::streamRead(uint32_t blockNumber, uint8_t* dst) {
+  uint16_t crc;
+  if (streamState_ != STREAM_READ || blockNumber != streamBlock_) {
+    // use address if not SDHC card
+    uint32_t arg = blockNumber;
+    if (type() != SD_CARD_TYPE_SDHC) arg <<= 9;
+
+    // CMD18 ends any sequence that is open
+    if (cardCommand(CMD18, arg)) {
+      error(SD_CARD_ERROR_CMD18);
+      goto fail;
+    }
+    streamState_ = STREAM_READ;
   } else {
-    SPSR |= (1 << SPI2X);
+    chipSelectLow();
   }
-  SPCR &= ~((1 <<SPR1) | (1 << SPR0));
-  SPCR |= (sckRateID & 4 ? (1 << SPR1) : 0)
-    | (sckRateID & 2 ? (1 << SPR0) : 0);
+  if (!waitStartBlock()) goto fail;
+
+  // transfer data
+  spi_->receive(dst, 512);
+
+  // check crc
+  crc = spi_->receive() << 8;
+  crc |= spi_->receive();
+  if (crcMode_ && crc != CRC16(0, dst, 512)) {
+    error(SD_CARD_ERROR_READ_CRC);
+    goto fail;
+  }
+  streamBlock_ = blockNumber + 1;
+  chipSelectHigh();
   return true;
+
+ fail:
+  if (streamState_ == STREAM_READ) {
+    // send CMD12 but keep the original error code
+    uint8_t code = errorCode_;
+    streamStop();
+    error(code);
+  }
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+/** End a multiple block transfer started by streamRead() or streamWrite().
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::streamStop(void) {
+  if (streamState_ == STREAM_WRITE) {
+    streamState_ = STREAM_IDLE;
+    return writeStop();
+  }
+  if (streamState_ == STREAM_READ) {
+    streamState_ = STREAM_IDLE;
+    if (cardCommand(CMD12, 0)) {
+      error(SD_CARD_ERROR_CMD12);
+      chipSelectHigh();
+      return false;
+    }
+    chipSelectHigh();
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Write a 512 byte block as part of a streamed multiple block write.
+ *
+ * A write multiple blocks sequence is started at \a blockNumber and left
+ * open so the next call for the following block only sends the data
+ * token and data.  Any other card command or streamStop() ends the sequence.
+ * Chip select is raised between blocks so the SPI bus may be shared.
+ *
+ * \param[in] blockNumber Logical block to be written.
+ * \param[in] src Pointer to the location of the data to be written.
+ * \param[in] eraseCount Blocks the card may pre-erase with ACMD23 if a
+ * new sequence is started.  Blocks pre-erased but not written before the
+ * sequence ends are left undefined, so this must not cover live data.
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::streamWrite(uint32_t blockNumber, const uint8_t* src,
+                             uint32_t eraseCount) {
+  if (streamState_ != STREAM_WRITE || blockNumber != streamBlock_) {
+    // ACMD23 has a 23 bit count
+    if (eraseCount > 0X7FFFFF) eraseCount = 0X7FFFFF;
+    // CMD25 ends any sequence that is open
+    if (!writeStart(blockNumber, eraseCount)) goto fail;
+    streamState_ = STREAM_WRITE;
+  } else {
+    chipSelectLow();
+  }
+  if (!writeData(src)) goto fail;
+  streamBlock_ = blockNumber + 1;
+  chipSelectHigh();
+  return true;
+
+ fail:
+  if (streamState_ == STREAM_WRITE) {
+    // send stop token but keep the original error code
+    uint8_t code = errorCode_;
+    streamStop();
+    error(code);
+  }
+  chipSelectHigh();
+  return false;
 }
 //------------------------------------------------------------------------------
 // wait for card to go not busy
 uint8_t Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
   uint16_t t0 = millis();
   do {
-    if (spiRec() == 0XFF) return true;
+    if (spi_->receive() == 0XFF) return true;
   }
   while (((uint16_t)millis() - t0) < timeoutMillis);
   return false;
@@ -559,7 +895,7 @@ uint8_t Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
 /** Wait for start block token */
 uint8_t Sd2Card::waitStartBlock(void) {
   uint16_t t0 = millis();
-  while ((status_ = spiRec()) == 0XFF) {
+  while ((status_ = spi_->receive()) == 0XFF) {
     if (((uint16_t)millis() - t0) > SD_READ_TIMEOUT) {
       error(SD_CARD_ERROR_READ_TIMEOUT);
       goto fail;
@@ -607,7 +943,7 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
     goto fail;
   }
   // response is r2 so get and check two bytes for nonzero
-  if (cardCommand(CMD13, 0) || spiRec()) {
+  if (cardCommand(CMD13, 0) || spi_->receive()) {
     error(SD_CARD_ERROR_WRITE_PROGRAMMING);
     goto fail;
   }
@@ -636,48 +972,16 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
   // CRC16 checksum is supposed to be ignored in SPI mode (unless
   // explicitly enabled) and a dummy value is normally written.
   // A few funny cards (e.g. Eye-Fi X2) expect a valid CRC anyway.
-  // Call setCRC(true) to enable CRC16 checksum on block writes.
-  // This has a noticeable impact on write speed. :(
-  int16_t crc;
-  if(writeCRC_) {
-    int16_t i, x;
-    // CRC16 code via Scott Dattalo www.dattalo.com
-    for(crc=i=0; i<512; i++) {
-      x   = ((crc >> 8) ^ src[i]) & 0xff;
-      x  ^= x >> 4;
-      crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x;
-    }
-  } else {
-    crc = 0xffff; // Dummy CRC value
-  }
-
-#ifdef OPTIMIZE_HARDWARE_SPI
-
-  // send data - optimized loop
-  SPDR = token;
-
-  // send two byte per iteration
-  for (uint16_t i = 0; i < 512; i += 2) {
-    while (!(SPSR & (1 << SPIF)));
-    SPDR = src[i];
-    while (!(SPSR & (1 << SPIF)));
-    SPDR = src[i+1];
-  }
-
-  // wait for last data byte
-  while (!(SPSR & (1 << SPIF)));
+  // Call enableCRC(true) to send and check CRC16 on all blocks.
+  uint16_t crc = crcMode_ ? CRC16(0, src, 512) : 0XFFFF;
 
-#else  // OPTIMIZE_HARDWARE_SPI
-  spiSend(token);
-  for (uint16_t i = 0; i < 512; i++) {
-    spiSend(src[i]);
-  }
-#endif  // OPTIMIZE_HARDWARE_SPI
+  spi_->send(token);
+  spi_->send(src, 512);
 
-  spiSend(crc >> 8); // Might be dummy value, that's OK
-  spiSend(crc);
+  spi_->send(crc >> 8); // Might be dummy value, that's OK
+  spi_->send(crc);
 
-  status_ = spiRec();
+  status_ = spi_->receive();
   if ((status_ & DATA_RES_MASK) != DATA_RES_ACCEPTED) {
     error(SD_CARD_ERROR_WRITE);
     chipSelectHigh();
@@ -729,8 +1033,9 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
  * the value zero, false, is returned for failure.
  */
 uint8_t Sd2Card::writeStop(void) {
+  chipSelectLow();
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
-  spiSend(STOP_TRAN_TOKEN);
+  spi_->send(STOP_TRAN_TOKEN);
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
   chipSelectHigh();
   return true;
@@ -741,7 +1046,35 @@ uint8_t Sd2Card::writeStop(void) {
   return false;
 }
 
-void Sd2Card::enableCRC(uint8_t mode) {
-  writeCRC_ = mode;
+//------------------------------------------------------------------------------
+/**
+ * Enable or disable CRC protection.
+ *
+ * When enabled every command carries a CRC7, data blocks are written
+ * with a CRC16 and the CRC16 of every block read is checked.  CMD59
+ * tells the card to check the CRCs it receives.  The mode is kept by
+ * init() so it may be set before or after the card is initialized.
+ *
+ * \param[in] mode The value true (non-zero) or false (zero).
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::enableCRC(uint8_t mode) {
+  uint8_t oldMode = crcMode_;
+  mode = mode != 0;
+  // wait for init() if the card is not ready
+  if (type()) {
+    // CMD59 must carry a valid CRC7 if checking is on now
+    crcMode_ = 1;
+    if (cardCommand(CMD59, mode)) {
+      crcMode_ = oldMode;
+      error(SD_CARD_ERROR_CMD59);
+      chipSelectHigh();
+      return false;
+    }
+    chipSelectHigh();
+  }
+  crcMode_ = mode;
+  return true;
 }
-
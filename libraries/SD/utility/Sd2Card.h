@@ -23,7 +23,23 @@
  * \file
  * Sd2Card class
  */
+/**
+ * Define SD_HOST_DEVICE non-zero to build the library on a host computer.
+ * The card is then an SdSpiCard that answers as an SD card from a RAM
+ * buffer or a FAT image file.  See Sd2Card::initRam() and
+ * Sd2Card::initImage().
+ */
+#ifndef SD_HOST_DEVICE
+#define SD_HOST_DEVICE 0
+#endif  // SD_HOST_DEVICE
+
+#if SD_HOST_DEVICE
+#include <stdio.h>
+#include <string.h>
+#else  // SD_HOST_DEVICE
+#include <avr/interrupt.h>
 #include "Sd2PinMap.h"
+#endif  // SD_HOST_DEVICE
 #include "SdInfo.h"
 /** Set SCK to max rate of F_CPU/2. See Sd2Card::setSckRate(). */
 uint8_t const SPI_FULL_SPEED = 0;
@@ -63,7 +79,10 @@ uint8_t const SPI_QUARTER_SPEED = 2;
 //------------------------------------------------------------------------------
 // SPI pin definitions
 //
-#ifndef SOFTWARE_SPI
+#if SD_HOST_DEVICE
+/** Chip select pin, unused by the host device */
+uint8_t const SD_CHIP_SELECT_PIN = 10;
+#elif !defined(SOFTWARE_SPI)
 // hardware pin defs
 /**
  * SD Chip Select pin
@@ -81,8 +100,6 @@ uint8_t const  SPI_MOSI_PIN = MOSI_PIN;
 uint8_t const  SPI_MISO_PIN = MISO_PIN;
 /** SPI Clock pin */
 uint8_t const  SPI_SCK_PIN = SCK_PIN;
-/** optimize loops for hardware SPI */
-//#define OPTIMIZE_HARDWARE_SPI  // MEME FIX ME LATER
 
 #else  // SOFTWARE_SPI
 // define software SPI pins so Mega/Leonardo can use unmodified GPS Shield
@@ -98,6 +115,16 @@ uint8_t const SPI_SCK_PIN = 13;
 //------------------------------------------------------------------------------
 /** Protect block zero from write if nonzero */
 #define SD_PROTECT_BLOCK_ZERO 1
+/**
+ * Define SD_CRC_TABLES non-zero to compute CRCs with 768 bytes of tables
+ * in flash.  Without tables CRC7 is computed a bit at a time and CRC16 a
+ * byte at a time with shifts, about half the speed of the tables.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_CRC_TABLES 1
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_CRC_TABLES 0
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
 /** init timeout ms */
 uint16_t const SD_INIT_TIMEOUT = 2000;
 /** erase timeout ms */
@@ -152,6 +179,14 @@ uint8_t const SD_CARD_ERROR_WRITE_PROGRAMMING = 0X14;
 uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X15;
 /** incorrect rate selected */
 uint8_t const SD_CARD_ERROR_SCK_RATE = 0X16;
+/** card returned an error response for CMD12 (stop transmission) */
+uint8_t const SD_CARD_ERROR_CMD12 = 0X17;
+/** card returned an error response for CMD18 (read multiple blocks) */
+uint8_t const SD_CARD_ERROR_CMD18 = 0X18;
+/** card returned an error response for CMD59 (CRC on/off) */
+uint8_t const SD_CARD_ERROR_CMD59 = 0X19;
+/** CRC16 of a data block read from the card did not match */
+uint8_t const SD_CARD_ERROR_READ_CRC = 0X1A;
 //------------------------------------------------------------------------------
 // card types
 /** Standard capacity V1 SD card */
@@ -161,6 +196,242 @@ uint8_t const SD_CARD_TYPE_SD2 = 2;
 /** High Capacity SD card */
 uint8_t const SD_CARD_TYPE_SDHC = 3;
 //------------------------------------------------------------------------------
+/**
+ * \class SdSpi
+ * \brief SPI transport used by Sd2Card.
+ *
+ * Sd2Card sends commands a byte at a time and moves data blocks with the
+ * buffer versions of receive() and send().  The defaults loop on the byte
+ * functions so a transport only needs its own buffer versions to move a
+ * block at full speed.  Pass a transport to
+ * Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, SdSpi* spi).
+ */
+class SdSpi {
+ public:
+  /** Set up the SPI pins and controller.  Called by Sd2Card::init(). */
+  virtual void begin(void) = 0;
+  /** \return The byte received while sending 0XFF. */
+  virtual uint8_t receive(void) = 0;
+  virtual void receive(uint8_t* buf, uint16_t n);
+  /** Send a byte and discard the byte received. */
+  virtual void send(uint8_t data) = 0;
+  virtual void send(const uint8_t* buf, uint16_t n);
+  virtual uint8_t setSckRate(uint8_t sckRateID);
+};
+//------------------------------------------------------------------------------
+#if !SD_HOST_DEVICE
+/**
+ * \class SdSpiHardware
+ * \brief SdSpi for the AVR SPI controller.
+ */
+class SdSpiHardware : public SdSpi {
+ public:
+  void begin(void);
+  /** \return The byte received while sending 0XFF. */
+  uint8_t receive(void) {
+    send(0XFF);
+    return SPDR;
+  }
+  void receive(uint8_t* buf, uint16_t n);
+  /** Send a byte. */
+  void send(uint8_t data) {
+    SPDR = data;
+    while (!(SPSR & (1 << SPIF)));
+  }
+  void send(const uint8_t* buf, uint16_t n);
+  uint8_t setSckRate(uint8_t sckRateID);
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SdSpiSoft
+ * \brief SdSpi bit-banged on any three pins chosen at run time.
+ */
+class SdSpiSoft : public SdSpi {
+ public:
+  void begin(void);
+  uint8_t receive(void);
+  void receive(uint8_t* buf, uint16_t n);
+  void send(uint8_t data);
+  void send(const uint8_t* buf, uint16_t n);
+  void setPins(uint8_t mosiPin, uint8_t misoPin, uint8_t sckPin);
+
+ private:
+  uint8_t mosiPin_;
+  uint8_t misoPin_;
+  uint8_t sckPin_;
+  volatile uint8_t* mosiPort_;
+  volatile uint8_t* misoPort_;
+  volatile uint8_t* sckPort_;
+  uint8_t mosiMask_;
+  uint8_t misoMask_;
+  uint8_t sckMask_;
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SdSpiSoftFixed
+ * \brief SdSpi bit-banged on three pins fixed at compile time.
+ *
+ * The pins are constants so each bit is a single sbi, cbi or sbic
+ * instruction.  Used for SOFTWARE_SPI.
+ */
+template<uint8_t MosiPin, uint8_t MisoPin, uint8_t SckPin>
+class SdSpiSoftFixed : public SdSpi {
+ public:
+  /** Set up the SPI pins. */
+  void begin(void) {
+    setPinMode(MisoPin, 0);
+    setPinMode(MosiPin, 1);
+    setPinMode(SckPin, 1);
+    fastDigitalWrite(SckPin, 0);
+  }
+  /** \return The byte received while sending 0XFF. */
+  uint8_t receive(void) {
+    uint8_t data;
+    SdSpiSoftFixed::receive(&data, 1);
+    return data;
+  }
+  /** Receive \a n bytes while sending 0XFF. */
+  void receive(uint8_t* buf, uint16_t n) {
+    // output pin high - like sending 0XFF
+    fastDigitalWrite(MosiPin, 1);
+    for (uint16_t i = 0; i < n; i++) {
+      uint8_t data = 0;
+      // no interrupts during byte receive
+      uint8_t oldSREG = SREG;
+      cli();
+      receiveBit(&data); receiveBit(&data); receiveBit(&data);
+      receiveBit(&data); receiveBit(&data); receiveBit(&data);
+      receiveBit(&data); receiveBit(&data);
+      SREG = oldSREG;
+      buf[i] = data;
+    }
+  }
+  /** Send a byte. */
+  void send(uint8_t data) {
+    SdSpiSoftFixed::send(&data, 1);
+  }
+  /** Send \a n bytes. */
+  void send(const uint8_t* buf, uint16_t n) {
+    for (uint16_t i = 0; i < n; i++) {
+      uint8_t data = buf[i];
+      // no interrupts during byte send
+      uint8_t oldSREG = SREG;
+      cli();
+      sendBit(data, 0X80); sendBit(data, 0X40); sendBit(data, 0X20);
+      sendBit(data, 0X10); sendBit(data, 0X08); sendBit(data, 0X04);
+      sendBit(data, 0X02); sendBit(data, 0X01);
+      // hold SCK high for a few ns
+      asm volatile ("nop\n\tnop\n\t");
+      fastDigitalWrite(SckPin, 0);
+      SREG = oldSREG;
+    }
+  }
+
+ private:
+  static inline __attribute__((always_inline))
+    void receiveBit(uint8_t* data) {
+    fastDigitalWrite(SckPin, 1);
+    *data <<= 1;
+    if (fastDigitalRead(MisoPin)) *data |= 1;
+    fastDigitalWrite(SckPin, 0);
+  }
+  static inline __attribute__((always_inline))
+    void sendBit(uint8_t data, uint8_t mask) {
+    fastDigitalWrite(SckPin, 0);
+    fastDigitalWrite(MosiPin, data & mask);
+    fastDigitalWrite(SckPin, 1);
+  }
+};
+#endif  // !SD_HOST_DEVICE
+//------------------------------------------------------------------------------
+#if SD_HOST_DEVICE
+/**
+ * \struct sdHostStats_t
+ * \brief Traffic counted by SdSpiCard.
+ */
+struct sdHostStats_t {
+  /** card commands received, CMD55 included */
+  uint32_t commands;
+  /** blocks transferred from the card */
+  uint32_t blocksRead;
+  /** blocks transferred to the card */
+  uint32_t blocksWritten;
+  /** blocks erased */
+  uint32_t blocksErased;
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SdSpiCard
+ * \brief SdSpi for a host build that answers as an SDHC card.
+ *
+ * Blocks live in a RAM buffer or an image file.  Commands and data blocks
+ * are decoded from the bytes sent, and the responses, data tokens and
+ * CRCs a card would return are queued for receive().  All of Sd2Card's
+ * command, CRC and stream code runs against it.  Once CMD59 turns CRC
+ * checking on, a command or data block with a bad CRC is rejected as a
+ * card would reject it.  A test harness may derive from it, or supply
+ * its own SdSpi, to inject errors.
+ */
+class SdSpiCard : public SdSpi {
+ public:
+  /** Construct a card with no blocks attached. */
+  SdSpiCard(void) : blockCount_(0), file_(0), ram_(0) {
+    clearStats();
+    reset();
+  }
+  uint8_t attachImage(const char* path);
+  uint8_t attachRam(uint8_t* ram, uint32_t blockCount);
+  void begin(void);
+  /** \return The number of 512 byte blocks attached. */
+  uint32_t blockCount(void) const {return blockCount_;}
+  /** Reset the traffic counters. */
+  void clearStats(void) {memset(&stats_, 0, sizeof(stats_));}
+  uint8_t receive(void);
+  void receive(uint8_t* buf, uint16_t n);
+  void send(uint8_t data);
+  using SdSpi::send;
+  /** \return Traffic since the last call to clearStats(). */
+  const sdHostStats_t& stats(void) const {return stats_;}
+
+ private:
+  // values for mode_
+  static uint8_t const MODE_IDLE = 0;
+  static uint8_t const MODE_COMMAND = 1;
+  static uint8_t const MODE_WRITE_SINGLE = 2;
+  static uint8_t const MODE_WRITE_MULTIPLE = 3;
+  static uint8_t const MODE_WRITE_DATA = 4;
+
+  uint8_t appCmd_;
+  uint32_t block_;
+  uint32_t blockCount_;
+  uint8_t cmd_[6];
+  uint8_t crcMode_;
+  uint8_t data_[514];
+  uint32_t eraseEnd_;
+  uint32_t eraseStart_;
+  FILE* file_;
+  uint8_t idle_;
+  uint16_t inCount_;
+  uint8_t initCount_;
+  uint8_t mode_;
+  uint8_t multiple_;
+  uint8_t out_[520];
+  uint16_t outCount_;
+  uint16_t outIndex_;
+  uint8_t* ram_;
+  uint8_t readStream_;
+  sdHostStats_t stats_;
+
+  void command(void);
+  void dataBlock(void);
+  void queue(uint8_t b) {if (outCount_ < sizeof(out_)) out_[outCount_++] = b;}
+  void queueBlock(const uint8_t* src, uint16_t n);
+  uint8_t readBlock(uint32_t block, uint8_t* dst);
+  void reset(void);
+  uint8_t writeBlock(uint32_t block, const uint8_t* src);
+};
+#endif  // SD_HOST_DEVICE
+//------------------------------------------------------------------------------
 /**
  * \class Sd2Card
  * \brief Raw access to SD and SDHC flash memory cards.
@@ -168,7 +439,8 @@ uint8_t const SD_CARD_TYPE_SDHC = 3;
 class Sd2Card {
  public:
   /** Construct an instance of Sd2Card. */
-  Sd2Card(void) : errorCode_(0), inBlock_(0), partialBlockRead_(0), type_(0) {}
+  Sd2Card(void) : crcMode_(0), errorCode_(0), inBlock_(0),
+    partialBlockRead_(0), spi_(0), streamState_(0), type_(0) {}
   uint32_t cardSize(void);
   uint8_t erase(uint32_t firstBlock, uint32_t lastBlock);
   uint8_t eraseSingleBlockEnable(void);
@@ -194,6 +466,15 @@ class Sd2Card {
     return init(sckRateID, SD_CHIP_SELECT_PIN);
   }
   uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin = -1, int8_t misoPin = -1, int8_t clockPin = -1);
+  uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin, SdSpi* spi);
+#if SD_HOST_DEVICE
+  /** \return Traffic seen by the host card since hostStatsClear(). */
+  const sdHostStats_t& hostStats(void) const {return hostCard_.stats();}
+  /** Reset the host card traffic counters. */
+  void hostStatsClear(void) {hostCard_.clearStats();}
+  uint8_t initImage(const char* path);
+  uint8_t initRam(uint8_t* ram, uint32_t blockCount);
+#endif  // SD_HOST_DEVICE
   void partialBlockRead(uint8_t value);
   /** Returns the current value, true or false, for partial block read. */
   uint8_t partialBlockRead(void) const {return partialBlockRead_;}
@@ -215,24 +496,40 @@ class Sd2Card {
   }
   void readEnd(void);
   uint8_t setSckRate(uint8_t sckRateID);
+  uint8_t streamRead(uint32_t blockNumber, uint8_t* dst);
+  uint8_t streamStop(void);
+  uint8_t streamWrite(uint32_t blockNumber, const uint8_t* src,
+                      uint32_t eraseCount = 1);
   /** Return the card type: SD V1, SD V2 or SDHC */
   uint8_t type(void) const {return type_;}
   uint8_t writeBlock(uint32_t blockNumber, const uint8_t* src);
   uint8_t writeData(const uint8_t* src);
   uint8_t writeStart(uint32_t blockNumber, uint32_t eraseCount);
   uint8_t writeStop(void);
-  void    enableCRC(uint8_t mode);
+  uint8_t enableCRC(uint8_t mode);
 
  private:
+  // values for streamState_
+  static uint8_t const STREAM_IDLE = 0;
+  static uint8_t const STREAM_WRITE = 1;
+  static uint8_t const STREAM_READ = 2;
+
   uint32_t block_;
   uint8_t chipSelectPin_;
+  uint16_t crc_;
+  uint8_t crcMode_;
   uint8_t errorCode_;
   uint8_t inBlock_;
   uint16_t offset_;
   uint8_t partialBlockRead_;
+  SdSpi* spi_;
   uint8_t status_;
+  uint32_t streamBlock_;
+  uint8_t streamState_;
   uint8_t type_;
-  uint8_t writeCRC_;
+#if SD_HOST_DEVICE
+  SdSpiCard hostCard_;
+#endif  // SD_HOST_DEVICE
 
   // private functions
   uint8_t cardAcmd(uint8_t cmd, uint32_t arg) {
@@ -242,6 +539,7 @@ class Sd2Card {
   uint8_t cardCommand(uint8_t cmd, uint32_t arg);
   void error(uint8_t code) {errorCode_ = code;}
   uint8_t readRegister(uint8_t cmd, void* buf);
+  uint8_t readRest(void);
   uint8_t sendWriteCommand(uint32_t blockNumber, uint32_t eraseCount);
   void chipSelectHigh(void);
   void chipSelectLow(void);
@@ -0,0 +1,385 @@
+/* Arduino Sd2Card Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino Sd2Card Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino Sd2Card Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "Sd2Card.h"
+#if SD_HOST_DEVICE
+//------------------------------------------------------------------------------
+// SdSpiCard for a host build.  Blocks live in a RAM buffer or an image file.
+// Sd2Card talks to it over SdSpi as it would to an SDHC card on the SPI bus,
+// and it counts the commands and blocks it sees.
+//------------------------------------------------------------------------------
+/** R1 response bit for a command with a bad CRC */
+static uint8_t const R1_COM_CRC_ERROR = 0X08;
+/** R1 response bit for a block address out of range */
+static uint8_t const R1_ADDRESS_ERROR = 0X20;
+/** data response token for a block with a bad CRC */
+static uint8_t const DATA_RES_CRC_ERROR = 0X0B;
+/** data response token for a block that failed to write */
+static uint8_t const DATA_RES_WRITE_ERROR = 0X0D;
+/** data error token for a block that failed to read */
+static uint8_t const DATA_ERROR_TOKEN = 0X01;
+//------------------------------------------------------------------------------
+// CRCs computed a bit at a time, apart from the Sd2Card code they check.
+/** \return The CRC7 of \a n bytes with the end bit set, as sent. */
+static uint8_t crc7(const uint8_t* data, uint8_t n) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    for (uint8_t m = 0X80; m; m >>= 1) {
+      uint8_t bit = ((crc >> 6) ^ (data[i] & m ? 1 : 0)) & 1;
+      crc = (crc << 1) & 0X7F;
+      if (bit) crc ^= 0X09;
+    }
+  }
+  return (crc << 1) | 1;
+}
+//------------------------------------------------------------------------------
+/** \return The CRC16 of \a n bytes. */
+static uint16_t crc16(const uint8_t* data, uint16_t n) {
+  uint16_t crc = 0;
+  for (uint16_t i = 0; i < n; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t j = 0; j < 8; j++) {
+      crc = crc & 0X8000 ? (crc << 1) ^ 0X1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+//==============================================================================
+// SdSpiCard
+/**
+ * Attach an image file as the card.  Writes go to the file.
+ *
+ * \param[in] path Name of a file holding a raw card or partition image.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdSpiCard::attachImage(const char* path) {
+  long size;
+  if (file_) fclose(file_);
+  blockCount_ = 0;
+  ram_ = 0;
+  file_ = fopen(path, "r+b");
+  if (!file_ || fseek(file_, 0, SEEK_END)) return false;
+  size = ftell(file_);
+  if (size < 512) return false;
+  blockCount_ = size >> 9;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Attach a RAM buffer as the card.
+ *
+ * \param[in] ram The buffer, 512 bytes for each block.
+ * \param[in] blockCount Number of blocks in \a ram.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdSpiCard::attachRam(uint8_t* ram, uint32_t blockCount) {
+  if (file_) fclose(file_);
+  file_ = 0;
+  ram_ = ram;
+  blockCount_ = ram ? blockCount : 0;
+  return blockCount_ != 0;
+}
+//------------------------------------------------------------------------------
+/** Power up the card.  It waits for CMD0 as after a power cycle. */
+void SdSpiCard::begin(void) {
+  reset();
+}
+//------------------------------------------------------------------------------
+/** Decode the command in cmd_ and queue the response. */
+void SdSpiCard::command(void) {
+  uint8_t cmd = cmd_[0] & 0X3F;
+  uint8_t app = appCmd_;
+  uint32_t arg = ((uint32_t)cmd_[1] << 24) | ((uint32_t)cmd_[2] << 16)
+                 | ((uint32_t)cmd_[3] << 8) | cmd_[4];
+  // a command ends any data the card was sending
+  outCount_ = outIndex_ = 0;
+  readStream_ = 0;
+  mode_ = MODE_IDLE;
+  appCmd_ = 0;
+  stats_.commands++;
+  // CMD0 and CMD8 are always checked, the rest once CMD59 turns CRC on
+  if ((crcMode_ || cmd == CMD0 || cmd == CMD8) && cmd_[5] != crc7(cmd_, 5)) {
+    queue(0XFF);
+    queue(R1_COM_CRC_ERROR | idle_);
+    return;
+  }
+  if (cmd == CMD0) {
+    reset();
+    idle_ = R1_IDLE_STATE;
+  }
+  // one byte of NCR before the response
+  queue(0XFF);
+  if (app && cmd == ACMD41) {
+    // report ready on the second call so init() loops once
+    if (initCount_++) idle_ = R1_READY_STATE;
+    queue(idle_);
+  } else if (app && cmd == ACMD23) {
+    queue(idle_);
+  } else if (cmd == CMD0 || cmd == CMD55) {
+    appCmd_ = cmd == CMD55;
+    queue(idle_);
+  } else if (cmd == CMD8) {
+    // R7, voltage accepted and the check pattern echoed
+    queue(idle_);
+    queue(0);
+    queue(0);
+    queue(cmd_[3] & 0X0F);
+    queue(cmd_[4]);
+  } else if (cmd == CMD58) {
+    // OCR, powered up and high capacity
+    queue(idle_);
+    queue(0XC0);
+    queue(0XFF);
+    queue(0X80);
+    queue(0X00);
+  } else if (cmd == CMD59) {
+    crcMode_ = arg & 1;
+    queue(idle_);
+  } else if (idle_) {
+    // data commands wait for ACMD41
+    queue(idle_ | R1_ILLEGAL_COMMAND);
+  } else if (cmd == CMD9) {
+    // CSD version 2.0 with C_SIZE in units of 512 KB and ERASE_BLK_EN
+    uint32_t cSize = blockCount_ >> 10 ? (blockCount_ >> 10) - 1 : 0;
+    uint8_t csd[16] = {0X40, 0X0E, 0X00, 0X32, 0X5B, 0X59, 0X00,
+      (uint8_t)(cSize >> 16), (uint8_t)(cSize >> 8), (uint8_t)cSize,
+      0X7F, 0X80, 0X0A, 0X40, 0X00, 0X01};
+    csd[15] = crc7(csd, 15);
+    queue(R1_READY_STATE);
+    queueBlock(csd, 16);
+  } else if (cmd == CMD10) {
+    uint8_t cid[16] = {0X00, 'S', 'D', 'H', 'O', 'S', 'T', ' ', 0X10,
+      0X00, 0X00, 0X00, 0X01, 0X01, 0X01, 0X01};
+    cid[15] = crc7(cid, 15);
+    queue(R1_READY_STATE);
+    queueBlock(cid, 16);
+  } else if (cmd == CMD12) {
+    // the stuff byte Sd2Card skips, then R1
+    queue(R1_READY_STATE);
+  } else if (cmd == CMD13) {
+    // R2
+    queue(R1_READY_STATE);
+    queue(0);
+  } else if (cmd == CMD17 || cmd == CMD18
+    || cmd == CMD24 || cmd == CMD25) {
+    if (arg >= blockCount_) {
+      queue(R1_ADDRESS_ERROR);
+      return;
+    }
+    queue(R1_READY_STATE);
+    block_ = arg;
+    if (cmd == CMD17) {
+      uint8_t buf[512];
+      if (readBlock(block_, buf)) {
+        queueBlock(buf, 512);
+      } else {
+        queue(0XFF);
+        queue(DATA_ERROR_TOKEN);
+      }
+    } else if (cmd == CMD18) {
+      // blocks are queued by receive() as they are read
+      readStream_ = 1;
+    } else {
+      multiple_ = cmd == CMD25;
+      mode_ = multiple_ ? MODE_WRITE_MULTIPLE : MODE_WRITE_SINGLE;
+    }
+  } else if (cmd == CMD32 || cmd == CMD33) {
+    if (cmd == CMD32) {
+      eraseStart_ = arg;
+    } else {
+      eraseEnd_ = arg;
+    }
+    queue(R1_READY_STATE);
+  } else if (cmd == CMD38) {
+    // erased blocks read as zero
+    uint8_t zero[512];
+    if (eraseStart_ > eraseEnd_ || eraseEnd_ >= blockCount_) {
+      queue(R1_ADDRESS_ERROR);
+      return;
+    }
+    memset(zero, 0, sizeof(zero));
+    for (uint32_t b = eraseStart_; b <= eraseEnd_; b++) {
+      writeBlock(b, zero);
+      stats_.blocksErased++;
+    }
+    queue(R1_READY_STATE);
+  } else {
+    queue(R1_ILLEGAL_COMMAND);
+  }
+}
+//------------------------------------------------------------------------------
+/** Write the data block in data_ and queue the data response. */
+void SdSpiCard::dataBlock(void) {
+  uint16_t crc = (data_[512] << 8) | data_[513];
+  mode_ = multiple_ ? MODE_WRITE_MULTIPLE : MODE_IDLE;
+  if (crcMode_ && crc != crc16(data_, 512)) {
+    queue(DATA_RES_CRC_ERROR);
+  } else if (block_ >= blockCount_ || !writeBlock(block_, data_)) {
+    queue(DATA_RES_WRITE_ERROR);
+  } else {
+    queue(DATA_RES_ACCEPTED);
+    stats_.blocksWritten++;
+    block_++;
+  }
+}
+//------------------------------------------------------------------------------
+/** Queue a data token, \a n bytes and their CRC16. */
+void SdSpiCard::queueBlock(const uint8_t* src, uint16_t n) {
+  uint16_t crc = crc16(src, n);
+  // one byte of access time before the token
+  queue(0XFF);
+  queue(DATA_START_BLOCK);
+  memcpy(out_ + outCount_, src, n);
+  outCount_ += n;
+  queue(crc >> 8);
+  queue(crc);
+  if (n == 512) stats_.blocksRead++;
+}
+//------------------------------------------------------------------------------
+/** Copy one block from the RAM buffer or image file. */
+uint8_t SdSpiCard::readBlock(uint32_t block, uint8_t* dst) {
+  if (block >= blockCount_) return false;
+  if (ram_) {
+    memcpy(dst, ram_ + 512UL*block, 512);
+    return true;
+  }
+  return !fseek(file_, 512L*block, SEEK_SET)
+    && fread(dst, 1, 512, file_) == 512;
+}
+//------------------------------------------------------------------------------
+/** \return The next byte the card sends. */
+uint8_t SdSpiCard::receive(void) {
+  uint8_t b;
+  SdSpiCard::receive(&b, 1);
+  return b;
+}
+//------------------------------------------------------------------------------
+/** Receive \a n bytes while sending 0XFF. */
+void SdSpiCard::receive(uint8_t* buf, uint16_t n) {
+  for (uint16_t i = 0; i < n;) {
+    if (outIndex_ == outCount_) {
+      outIndex_ = outCount_ = 0;
+      // a read multiple blocks command sends blocks until CMD12
+      if (readStream_ && mode_ == MODE_IDLE) {
+        uint8_t blk[512];
+        if (block_ < blockCount_ && readBlock(block_, blk)) {
+          queueBlock(blk, 512);
+          block_++;
+        } else {
+          queue(0XFF);
+          queue(DATA_ERROR_TOKEN);
+          readStream_ = 0;
+        }
+      }
+    }
+    if (outIndex_ == outCount_) {
+      // nothing to send, the card is not busy
+      buf[i++] = 0XFF;
+      continue;
+    }
+    uint16_t m = outCount_ - outIndex_;
+    if (m > n - i) m = n - i;
+    memcpy(buf + i, out_ + outIndex_, m);
+    outIndex_ += m;
+    i += m;
+  }
+}
+//------------------------------------------------------------------------------
+/** Go idle with CRC checking off, as after power up or CMD0. */
+void SdSpiCard::reset(void) {
+  appCmd_ = crcMode_ = initCount_ = multiple_ = readStream_ = 0;
+  idle_ = R1_IDLE_STATE;
+  inCount_ = outCount_ = outIndex_ = 0;
+  mode_ = MODE_IDLE;
+  block_ = eraseStart_ = eraseEnd_ = 0;
+}
+//------------------------------------------------------------------------------
+/** Take a byte from the host and act on it. */
+void SdSpiCard::send(uint8_t data) {
+  if (!blockCount_) return;
+  if (mode_ == MODE_COMMAND) {
+    cmd_[inCount_++] = data;
+    if (inCount_ == 6) command();
+  } else if (mode_ == MODE_WRITE_DATA) {
+    data_[inCount_++] = data;
+    if (inCount_ == sizeof(data_)) dataBlock();
+  } else if ((data & 0XC0) == 0X40) {
+    // start bit zero and transmission bit one begin a command
+    cmd_[0] = data;
+    inCount_ = 1;
+    mode_ = MODE_COMMAND;
+  } else if ((mode_ == MODE_WRITE_SINGLE && data == DATA_START_BLOCK)
+    || (mode_ == MODE_WRITE_MULTIPLE && data == WRITE_MULTIPLE_TOKEN)) {
+    inCount_ = 0;
+    mode_ = MODE_WRITE_DATA;
+  } else if (mode_ == MODE_WRITE_MULTIPLE && data == STOP_TRAN_TOKEN) {
+    mode_ = MODE_IDLE;
+  }
+}
+//------------------------------------------------------------------------------
+/** Copy one block to the RAM buffer or image file. */
+uint8_t SdSpiCard::writeBlock(uint32_t block, const uint8_t* src) {
+  if (block >= blockCount_) return false;
+  if (ram_) {
+    memcpy(ram_ + 512UL*block, src, 512);
+    return true;
+  }
+  return !fseek(file_, 512L*block, SEEK_SET)
+    && fwrite(src, 1, 512, file_) == 512 && !fflush(file_);
+}
+//==============================================================================
+// Sd2Card
+/**
+ * Attach an image file as the host card and initialize it.  Writes go to
+ * the file.
+ *
+ * \param[in] path Name of a file holding a raw card or partition image.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::initImage(const char* path) {
+  if (!hostCard_.attachImage(path)) {
+    error(SD_CARD_ERROR_CMD0);
+    return false;
+  }
+  return init();
+}
+//------------------------------------------------------------------------------
+/**
+ * Attach a RAM buffer as the host card and initialize it.
+ *
+ * \param[in] ram The buffer, 512 bytes for each block.
+ * \param[in] blockCount Number of blocks in \a ram.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::initRam(uint8_t* ram, uint32_t blockCount) {
+  if (!hostCard_.attachRam(ram, blockCount)) {
+    error(SD_CARD_ERROR_CMD0);
+    return false;
+  }
+  return init();
+}
+#endif  // SD_HOST_DEVICE
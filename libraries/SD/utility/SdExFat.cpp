@@ -0,0 +1,522 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <SdFat.h>
+#if SD_EXFAT_SUPPORT
+//------------------------------------------------------------------------------
+// exFAT support for SdFile and SdVolume.
+//
+// An exFAT file is a set of directory entries, a file entry, a stream
+// extension entry with the size and first cluster, then name entries.
+// Clusters are allocated in a bitmap and a contiguous file may have no
+// FAT chain.  Only names that are valid 8.3 names can be opened, the
+// upcase table is not read so names are compared as upper case ASCII.
+//==============================================================================
+// SdFile exFAT functions
+//------------------------------------------------------------------------------
+// compute the checksum of the open file's entry set and store it
+uint8_t SdFile::exFatChecksum(void) {
+  uint16_t sum = 0;
+  for (uint8_t i = 0; i < setCount_; i++) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(
+                   exFatEntry(i, SdVolume::CACHE_FOR_READ));
+    if (!p) return false;
+    for (uint8_t j = 0; j < 32; j++) {
+      // skip the checksum field
+      if (i == 0 && (j == 2 || j == 3)) continue;
+      sum = ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + p[j];
+    }
+  }
+  exFile_t* f = reinterpret_cast<exFile_t*>(
+                  exFatEntry(0, SdVolume::CACHE_FOR_WRITE));
+  if (!f) return false;
+  f->setChecksum = sum;
+  return true;
+}
+//------------------------------------------------------------------------------
+// format an entry set as a FAT directory entry
+void SdFile::exFatDir(const exFatSet_t& set, dir_t* dir) {
+  memset(dir, 0, sizeof(dir_t));
+  memcpy(dir->name, set.name, 11);
+  dir->attributes = set.attributes;
+  dir->creationDate = set.createTimestamp >> 16;
+  dir->creationTime = set.createTimestamp & 0XFFFF;
+  dir->lastWriteDate = set.modifyTimestamp >> 16;
+  dir->lastWriteTime = set.modifyTimestamp & 0XFFFF;
+  dir->lastAccessDate = dir->lastWriteDate;
+  dir->firstClusterHigh = set.firstCluster >> 16;
+  dir->firstClusterLow = set.firstCluster & 0XFFFF;
+  if (!(set.attributes & DIR_ATT_DIRECTORY)) dir->fileSize = set.validLength;
+}
+//------------------------------------------------------------------------------
+// cache entry i of the open file's set, a set spans at most two blocks
+void* SdFile::exFatEntry(uint8_t i, uint8_t action) {
+  i += dirIndex_;
+  uint32_t block = i < 16 ? dirBlock_ : setBlock_;
+  if (!SdVolume::cacheRawBlock(block, action,
+                               SdVolume::CACHE_PRIORITY_DIR)) return NULL;
+  return SdVolume::cacheBuffer()->dir + (i & 0XF);
+}
+//------------------------------------------------------------------------------
+// Link the clusters of a contiguous file in the FAT, it is about to get
+// curCluster_ which doesn't follow last, its old last cluster.
+uint8_t SdFile::exFatMakeChain(uint32_t last) {
+  for (uint32_t c = firstCluster_; c != last; c++) {
+    if (!vol_->fatPut(c, c + 1)) return false;
+  }
+  if (!vol_->fatPut(last, curCluster_)) return false;
+  if (!vol_->fatPutEOC(curCluster_)) return false;
+  exFlags_ &= ~EXFAT_FLAG_NO_FAT_CHAIN;
+  flags_ |= F_FILE_DIR_DIRTY;
+  return true;
+}
+//------------------------------------------------------------------------------
+// hash of the up-cased UTF-16 name, all characters are ASCII
+uint16_t SdFile::exFatNameHash(const uint8_t* name, uint8_t length) {
+  uint16_t hash = 0;
+  for (uint8_t i = 0; i < length; i++) {
+    uint8_t c = name[i];
+    if ('a' <= c && c <= 'z') c += 'A' - 'a';
+    // low then high byte of the UTF-16 character
+    hash = ((hash & 1) ? 0X8000 : 0) + (hash >> 1) + c;
+    hash = ((hash & 1) ? 0X8000 : 0) + (hash >> 1);
+  }
+  return hash;
+}
+//------------------------------------------------------------------------------
+// open() by name for an exFAT directory, dname is the 8.3 form of fileName
+uint8_t SdFile::exFatOpen(SdFile* dirFile, const char* fileName,
+                          const uint8_t* dname, uint8_t oflag) {
+  exFatSet_t set;
+  // a new set needs three free entries
+  uint8_t freeCount = 0;
+  uint32_t freePos = 0;
+
+  dirFile->rewind();
+  while (dirFile->curPosition_ < dirFile->fileSize_) {
+    uint32_t pos = dirFile->curPosition_;
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) return false;
+    uint8_t type = p->name[0];
+
+    if (!(type & EXFAT_TYPE_IN_USE)) {
+      // remember first run of free entries
+      if (freeCount == 0) freePos = pos;
+      if (freeCount < 3) freeCount++;
+      // done if no entries follow
+      if (type == 0 && freeCount == 3) break;
+      continue;
+    }
+    if (freeCount < 3) freeCount = 0;
+    if (type != EXFAT_TYPE_FILE) continue;
+
+    if (!dirFile->seekSet(pos)) return false;
+    int8_t n = dirFile->exFatReadSet(&set);
+    if (n < 0) return false;
+    if (n == 0 || memcmp(dname, set.name, 11)) continue;
+
+    // don't open existing file if O_CREAT and O_EXCL
+    if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+    return exFatOpenSet(set, oflag);
+  }
+  // only create file if O_CREAT and O_WRITE
+  if ((oflag & (O_CREAT | O_WRITE)) != (O_CREAT | O_WRITE)) return false;
+
+  if (freeCount < 3) {
+    // the free run ends the directory and goes on in the new cluster
+    if (freeCount == 0) freePos = dirFile->fileSize_;
+    if (!dirFile->addDirCluster()) return false;
+    if (!dirFile->sync()) return false;
+
+    // curCluster_ is now the new cluster, seek from the start
+    dirFile->rewind();
+  }
+  // locate the blocks of the new set
+  if (!dirFile->seekSet(freePos)) return false;
+  for (uint8_t i = 0; i < 3; i++) {
+    if (!dirFile->readDirCache()) return false;
+    if (i == 0) set.block = SdVolume::cacheBlockNumber();
+  }
+  set.lastBlock = SdVolume::cacheBlockNumber();
+  set.index = (freePos >> 5) & 0XF;
+  set.count = 3;
+  set.attributes = DIR_ATT_ARCHIVE;
+  set.flags = EXFAT_FLAG_ALLOCATION_POSSIBLE | EXFAT_FLAG_NO_FAT_CHAIN;
+  set.firstCluster = 0;
+  set.dataLength = 0;
+  set.validLength = 0;
+
+  // set timestamps
+  uint16_t date = FAT_DEFAULT_DATE;
+  uint16_t time = FAT_DEFAULT_TIME;
+  if (dateTime_) dateTime_(&date, &time);
+  set.createTimestamp = (uint32_t)date << 16 | time;
+  set.modifyTimestamp = set.createTimestamp;
+
+  dirBlock_ = set.block;
+  dirIndex_ = set.index;
+  setBlock_ = set.lastBlock;
+  setCount_ = set.count;
+
+  // initialize the entries of the set
+  exFile_t* f = reinterpret_cast<exFile_t*>(
+                  exFatEntry(0, SdVolume::CACHE_FOR_WRITE));
+  if (!f) return false;
+  memset(f, 0, sizeof(exFile_t));
+  f->type = EXFAT_TYPE_FILE;
+  f->secondaryCount = set.count - 1;
+  f->attributes = set.attributes;
+  f->createTimestamp = set.createTimestamp;
+  f->modifyTimestamp = set.createTimestamp;
+  f->accessTimestamp = set.createTimestamp;
+
+  uint8_t length = strlen(fileName);
+  exStream_t* s = reinterpret_cast<exStream_t*>(
+                    exFatEntry(1, SdVolume::CACHE_FOR_WRITE));
+  if (!s) return false;
+  memset(s, 0, sizeof(exStream_t));
+  s->type = EXFAT_TYPE_STREAM;
+  s->flags = set.flags;
+  s->nameLength = length;
+  s->nameHash = exFatNameHash(reinterpret_cast<const uint8_t*>(fileName),
+                              length);
+
+  // an 8.3 name fits in one name entry, case is kept
+  exName_t* nm = reinterpret_cast<exName_t*>(
+                   exFatEntry(2, SdVolume::CACHE_FOR_WRITE));
+  if (!nm) return false;
+  memset(nm, 0, sizeof(exName_t));
+  nm->type = EXFAT_TYPE_NAME;
+  for (uint8_t i = 0; i < length; i++) nm->name[i] = fileName[i];
+
+  // force write of set to SD
+  if (!exFatChecksum()) return false;
+  if (!SdVolume::cacheFlush()) return false;
+
+  return exFatOpenSet(set, oflag);
+}
+//------------------------------------------------------------------------------
+// open a file from an entry set read by exFatReadSet(), vol_ is set
+uint8_t SdFile::exFatOpenSet(const exFatSet_t& set, uint8_t oflag) {
+  // write or truncate is an error for a directory or read-only file
+  if (set.attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
+    if (oflag & (O_WRITE | O_TRUNC)) return false;
+  }
+  // bytes between validLength and dataLength would need zeroing
+  if ((oflag & (O_WRITE | O_TRUNC)) && set.validLength != set.dataLength) {
+    return false;
+  }
+  // exFatEntry() only handles sets in two blocks
+  if (set.index + set.count > 32) return false;
+
+  // remember location of entry set on SD
+  dirBlock_ = set.block;
+  dirIndex_ = set.index;
+  setBlock_ = set.lastBlock;
+  setCount_ = set.count;
+
+  firstCluster_ = set.firstCluster;
+  exFlags_ = set.flags;
+  if (set.attributes & DIR_ATT_DIRECTORY) {
+    fileSize_ = set.dataLength;
+    type_ = FAT_FILE_TYPE_SUBDIR;
+  } else {
+    fileSize_ = set.validLength;
+    type_ = FAT_FILE_TYPE_NORMAL;
+  }
+  // save open flags for read/write
+  flags_ = oflag & (O_ACCMODE | O_SYNC | O_APPEND);
+  extentReset();
+
+  // the entry on SD is current
+  syncedSize_ = fileSize_;
+  unsyncedBytes_ = 0;
+  unsyncedBlocks_ = 0;
+
+  // set to start of file
+  curCluster_ = 0;
+  curPosition_ = 0;
+
+  // truncate file to zero length if requested
+  if (oflag & O_TRUNC) return truncate(0);
+  return true;
+}
+//------------------------------------------------------------------------------
+// Read the entry set at the current position of this directory.  Returns
+// one for a valid set, zero if the entries are not a valid set or the file
+// is too large to open, and -1 for an I/O error.
+int8_t SdFile::exFatReadSet(exFatSet_t* set) {
+  char name[13];
+  uint8_t nameLength = 0;
+  uint8_t n = 0;
+  uint8_t count = 1;
+  uint8_t tooBig = false;
+  uint16_t sum = 0;
+  uint16_t setSum = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint32_t pos = curPosition_;
+    if (pos >= fileSize_) return 0;
+    uint8_t* p = reinterpret_cast<uint8_t*>(readDirCache());
+    if (!p) return -1;
+
+    if (i == 0) {
+      exFile_t* f = reinterpret_cast<exFile_t*>(p);
+      if (f->type != EXFAT_TYPE_FILE || f->secondaryCount < 2) return 0;
+      count = f->secondaryCount + 1;
+      setSum = f->setChecksum;
+      set->block = SdVolume::cacheBlockNumber();
+      set->index = (pos >> 5) & 0XF;
+      set->count = count;
+      set->attributes = f->attributes;
+      set->createTimestamp = f->createTimestamp;
+      set->modifyTimestamp = f->modifyTimestamp;
+    } else if (p[0] == EXFAT_TYPE_STREAM && i == 1) {
+      exStream_t* s = reinterpret_cast<exStream_t*>(p);
+      set->flags = s->flags;
+      set->firstCluster = s->firstCluster;
+      set->dataLength = s->dataLengthLow;
+      set->validLength = s->validLengthLow;
+      tooBig = s->dataLengthHigh != 0;
+      nameLength = s->nameLength;
+    } else if (i > 1 && (p[0] & (EXFAT_TYPE_IN_USE | 0X40)) == 0XC0) {
+      // secondary entry, only name entries are used
+      if (p[0] == EXFAT_TYPE_NAME) {
+        exName_t* nm = reinterpret_cast<exName_t*>(p);
+        for (uint8_t j = 0; j < 15 && n < nameLength; j++, n++) {
+          uint16_t c = nm->name[j];
+          if (n < 12) name[n] = c < 0X7F ? c : 0X7F;
+        }
+      }
+    } else {
+      // not part of the set, leave it for the caller
+      return seekSet(pos) ? 0 : -1;
+    }
+    for (uint8_t j = 0; j < 32; j++) {
+      // skip the checksum field
+      if (i == 0 && (j == 2 || j == 3)) continue;
+      sum = ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + p[j];
+    }
+    set->lastBlock = SdVolume::cacheBlockNumber();
+  }
+  if (sum != setSum || tooBig) return 0;
+
+  // names that aren't 8.3 can't be opened by name
+  name[n < 12 ? n : 12] = 0;
+  if (n != nameLength || n > 12 || !make83Name(name, set->name)) {
+    set->name[0] = 0;
+  }
+  return 1;
+}
+//------------------------------------------------------------------------------
+// mark the entries of the open file's set free
+uint8_t SdFile::exFatRemove(void) {
+  for (uint8_t i = 0; i < setCount_; i++) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(
+                   exFatEntry(i, SdVolume::CACHE_FOR_WRITE));
+    if (!p) return false;
+    p[0] &= ~EXFAT_TYPE_IN_USE;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// sync() for the entry set of an exFAT file
+uint8_t SdFile::exFatSync(void) {
+  exStream_t* s = reinterpret_cast<exStream_t*>(
+                    exFatEntry(1, SdVolume::CACHE_FOR_WRITE));
+  if (!s) return false;
+  s->flags = exFlags_;
+  s->firstCluster = firstCluster_;
+
+  // all bytes of a file are written, a directory is whole clusters
+  s->validLengthLow = fileSize_;
+  s->validLengthHigh = 0;
+  s->dataLengthLow = fileSize_;
+  s->dataLengthHigh = 0;
+
+  // set modify time if user supplied a callback date/time function
+  if (dateTime_) {
+    uint16_t date;
+    uint16_t time;
+    dateTime_(&date, &time);
+    exFile_t* f = reinterpret_cast<exFile_t*>(
+                    exFatEntry(0, SdVolume::CACHE_FOR_WRITE));
+    if (!f) return false;
+    f->modifyTimestamp = (uint32_t)date << 16 | time;
+    f->accessTimestamp = f->modifyTimestamp;
+  }
+  if (!exFatChecksum()) return false;
+
+  // clear directory dirty
+  flags_ &= ~F_FILE_DIR_DIRTY;
+  return true;
+}
+//==============================================================================
+// SdVolume exFAT functions
+//------------------------------------------------------------------------------
+// count free clusters in the allocation bitmap and set the free map
+int32_t SdVolume::bitmapFreeCount(void) {
+  int32_t free = 0;
+
+  // groups are full unless a bitmap byte in them has a free cluster
+  for (uint8_t i = 0; i < SD_FREE_MAP_SIZE; i++) freeMap_[i] = 0XFF;
+
+  for (uint32_t bit = 0; bit < clusterCount_; bit += 8) {
+    if ((bit & 0XFFF) == 0) {
+      uint32_t lba = bitmapStartBlock_ + (bit >> 12);
+      if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_PRIORITY_FAT)) return -1;
+    }
+    uint8_t b = cacheCurrent_->buf.data[(bit >> 3) & 0X1FF];
+
+    // bits past the last cluster are not free
+    if (clusterCount_ - bit < 8) b |= 0XFF << (clusterCount_ - bit);
+    if (b == 0XFF) continue;
+
+    for (uint8_t m = 1; m; m <<= 1) {
+      if (!(b & m)) free++;
+    }
+    // a byte is in one or two groups
+    uint32_t last = bit + 9;
+    if (last > clusterCount_ + 1) last = clusterCount_ + 1;
+    freeMapSet(bit + 2, false);
+    freeMapSet(last, false);
+  }
+  freeClusterCount_ = free;
+  return free;
+}
+//------------------------------------------------------------------------------
+// fetch the allocation bit of a cluster
+uint8_t SdVolume::bitmapGet(uint32_t cluster, uint32_t* used) const {
+  // error if not in bitmap
+  if (cluster < 2 || cluster > (clusterCount_ + 1)) return false;
+
+  uint32_t bit = cluster - 2;
+  uint32_t lba = bitmapStartBlock_ + (bit >> 12);
+  if (lba != cacheCurrent_->blockNumber) {
+    if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_PRIORITY_FAT)) return false;
+  }
+  *used = (cacheCurrent_->buf.data[(bit >> 3) & 0X1FF] >> (bit & 7)) & 1;
+  return true;
+}
+//------------------------------------------------------------------------------
+// set the allocation bits of count clusters from cluster
+uint8_t SdVolume::bitmapPut(uint32_t cluster, uint32_t count, uint8_t used) {
+  // error if not in bitmap
+  if (cluster < 2 || (cluster + count) > (clusterCount_ + 2)) return false;
+
+  for (uint32_t bit = cluster - 2; count; bit++, count--) {
+    uint32_t lba = bitmapStartBlock_ + (bit >> 12);
+    if (lba != cacheCurrent_->blockNumber) {
+      if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_PRIORITY_FAT)) {
+        return false;
+      }
+    }
+    uint8_t* p = cacheCurrent_->buf.data + ((bit >> 3) & 0X1FF);
+    uint8_t mask = 1 << (bit & 7);
+    if (!(*p & mask) == !used) continue;
+    *p ^= mask;
+    cacheSetDirty();
+
+    // maintain free cluster count and summary
+    if (used) {
+      if (freeClusterCount_ >= 0) freeClusterCount_--;
+    } else {
+      freeMapSet(bit + 2, false);
+      if (freeClusterCount_ >= 0) freeClusterCount_++;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// init() for an exFAT boot sector in the cache
+uint8_t SdVolume::exFatInit(uint32_t volumeStartBlock) {
+  exfbs_t* bs = &cacheCurrent_->buf.exfbs;
+
+  // only 512 byte blocks and one FAT, TexFAT has two
+  if (bs->bytesPerSectorShift != 9 ||
+    bs->sectorsPerClusterShift > 15 ||
+    bs->numberOfFats != 1 ||
+    bs->clusterCount == 0) {
+      return false;
+  }
+  fatCount_ = 1;
+  clusterSizeShift_ = bs->sectorsPerClusterShift;
+  blocksPerCluster_ = 1 << clusterSizeShift_;
+  blocksPerFat_ = bs->fatLength;
+  fatStartBlock_ = volumeStartBlock + bs->fatOffset;
+  dataStartBlock_ = volumeStartBlock + bs->clusterHeapOffset;
+  clusterCount_ = bs->clusterCount;
+  rootDirStart_ = bs->rootDirectoryCluster;
+  rootDirEntryCount_ = 0;
+  fatType_ = 64;
+
+  // no second FAT blocks are waiting
+  mirrorOffset_ = blocksPerFat_;
+  for (uint8_t i = 0; i < SD_FAT_MIRROR_PENDING; i++) mirrorPending_[i] = 0;
+
+  // free count is unknown and all groups may have free clusters
+  freeClusterCount_ = -1;
+  for (uint8_t i = 0; i < SD_FREE_MAP_SIZE; i++) freeMap_[i] = 0;
+
+  // smallest group of whole bitmap blocks that fits the summary
+  freeMapShift_ = 12;
+  while (((clusterCount_ + 1) >> freeMapShift_) >= 8 * SD_FREE_MAP_SIZE) {
+    freeMapShift_++;
+  }
+  // the allocation bitmap is listed in the first cluster of the root
+  uint32_t bitmapCluster = 0;
+  uint32_t bitmapSize = 0;
+  uint32_t block = clusterStartBlock(rootDirStart_);
+  for (uint16_t i = 0; i < blocksPerCluster_ && !bitmapCluster; i++) {
+    if (!cacheRawBlock(block + i, CACHE_FOR_READ, CACHE_PRIORITY_DIR)) {
+      return false;
+    }
+    for (uint8_t j = 0; j < 16; j++) {
+      exBitmap_t* b = reinterpret_cast<exBitmap_t*>(cacheCurrent_->buf.dir + j);
+      if (b->type == 0) return false;
+      if (b->type == EXFAT_TYPE_BITMAP) {
+        bitmapCluster = b->firstCluster;
+        bitmapSize = b->dataLengthLow;
+        break;
+      }
+    }
+  }
+  if (!bitmapCluster || bitmapSize < (clusterCount_ + 7)/8) return false;
+
+  // bitmap blocks are found by offset so the bitmap must be contiguous
+  uint32_t last = bitmapCluster + ((bitmapSize - 1) >> (clusterSizeShift_ + 9));
+  for (uint32_t c = bitmapCluster; c != last; c++) {
+    uint32_t next;
+    if (!fatGet(c, &next)) return false;
+    if (next != c + 1) return false;
+  }
+  bitmapStartBlock_ = clusterStartBlock(bitmapCluster);
+  return true;
+}
+//------------------------------------------------------------------------------
+// free count clusters from cluster
+uint8_t SdVolume::freeRange(uint32_t cluster, uint32_t count) {
+  if (count == 0) return true;
+  if (!bitmapPut(cluster, count, false)) return false;
+
+  // clear free cluster location
+  allocSearchStart_ = 2;
+  return true;
+}
+#endif  // SD_EXFAT_SUPPORT
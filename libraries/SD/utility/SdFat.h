@@ -33,8 +33,87 @@
  */
 #define ALLOW_DEPRECATED_FUNCTIONS 1
 //------------------------------------------------------------------------------
-// forward declaration since SdVolume is used in SdFile
+/**
+ * Size in bytes of the SdVolume free cluster summary.  Each bit covers a
+ * group of FAT blocks and is set once the group is known to have no free
+ * clusters so allocation can skip it without reading the FAT.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_FREE_MAP_SIZE 64
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_FREE_MAP_SIZE 16
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+//------------------------------------------------------------------------------
+/**
+ * Number of extents, runs of contiguous clusters, recorded by each SdFile.
+ * Seeks inside the mapped part of a file don't read the FAT.  Each extent
+ * costs eight bytes of RAM per SdFile.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_FILE_EXTENT_COUNT 4
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_FILE_EXTENT_COUNT 2
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+//------------------------------------------------------------------------------
+/**
+ * Number of directory entries remembered by SdFile::open().  A file or
+ * subdirectory opened again by name is found without searching its parent
+ * directory.  Each entry costs 20 bytes of RAM.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_DIR_LOOKUP_COUNT 8
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_DIR_LOOKUP_COUNT 4
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+//------------------------------------------------------------------------------
+/**
+ * Maximum number of entries in the directory indexed by SdFile::open().
+ * One directory larger than a block and no larger than this is indexed
+ * with a hash byte per entry so a name is found with one block read.
+ * Costs SD_DIR_INDEX_SIZE*5/4 bytes of RAM.  Zero disables the index.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_DIR_INDEX_SIZE 512
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_DIR_INDEX_SIZE 0
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+//------------------------------------------------------------------------------
+/**
+ * Number of 512 byte blocks held by the SdVolume cache.  With one slot
+ * every switch between FAT, directory and data blocks forces a flush and
+ * reread.  Each extra slot costs 524 bytes of RAM.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_CACHE_SLOT_COUNT 3
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_CACHE_SLOT_COUNT 1
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+//------------------------------------------------------------------------------
+/**
+ * Number of FAT blocks whose second copy can wait for the next sync with
+ * FAT_MIRROR_DEFER.  A block beyond this is mirrored when it is written.
+ * Each costs four bytes of RAM.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_FAT_MIRROR_PENDING 8
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define SD_FAT_MIRROR_PENDING 4
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+//------------------------------------------------------------------------------
+/**
+ * Set non-zero to mount exFAT volumes, the format of SDXC cards.  Names on
+ * exFAT are limited to the 8.3 names used for FAT.  Costs several KB of
+ * flash and six bytes of RAM per SdFile.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || SD_HOST_DEVICE
+#define SD_EXFAT_SUPPORT 1
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || SD_HOST_DEVICE
+#define SD_EXFAT_SUPPORT 0
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || SD_HOST_DEVICE
+//------------------------------------------------------------------------------
+// forward declarations since SdVolume and cacheSlot_t are used in SdFile
 class SdVolume;
+struct cacheSlot_t;
 //==============================================================================
 // SdFile class
 
@@ -128,14 +207,58 @@ uint16_t const FAT_DEFAULT_DATE = ((2000 - 1980) << 9) | (1 << 5) | 1;
 /** Default time for file timestamp is 1 am */
 uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 //------------------------------------------------------------------------------
+/**
+ * \brief Location of a recently opened directory entry
+ */
+struct dirLookup_t {
+           /** First cluster of the parent directory, zero for FAT16 root. */
+  uint32_t dirCluster;
+           /** Block that holds the entry or zero if unused. */
+  uint32_t block;
+           /** Index of the entry in block. */
+  uint8_t  index;
+           /** Name of the entry in 8.3 directory format. */
+  uint8_t  name[11];
+};
+//------------------------------------------------------------------------------
+/**
+ * \brief Fields of an exFAT directory entry set read by SdFile
+ */
+struct exFatSet_t {
+           /** Block that holds the file entry. */
+  uint32_t block;
+           /** Block that holds the last entry of the set. */
+  uint32_t lastBlock;
+           /** First cluster of the data, zero if none. */
+  uint32_t firstCluster;
+           /** Bytes allocated. */
+  uint32_t dataLength;
+           /** Bytes written, no more than dataLength. */
+  uint32_t validLength;
+           /** Creation time, FAT date in the high 16 bits. */
+  uint32_t createTimestamp;
+           /** Time of last write, FAT date in the high 16 bits. */
+  uint32_t modifyTimestamp;
+           /** Index of the file entry in block. */
+  uint8_t  index;
+           /** Number of entries in the set. */
+  uint8_t  count;
+           /** DIR_ATT_ bits. */
+  uint8_t  attributes;
+           /** EXFAT_FLAG_ bits from the stream extension entry. */
+  uint8_t  flags;
+           /** Name in 8.3 directory format, name[0] is zero if not 8.3. */
+  uint8_t  name[11];
+};
+//------------------------------------------------------------------------------
 /**
  * \class SdFile
- * \brief Access FAT16 and FAT32 files on SD and SDHC cards.
+ * \brief Access FAT16, FAT32 and exFAT files on SD, SDHC and SDXC cards.
  */
 class SdFile : public Print {
  public:
   /** Create an instance of SdFile. */
-  SdFile(void) : type_(FAT_FILE_TYPE_CLOSED) {}
+  SdFile(void) : type_(FAT_FILE_TYPE_CLOSED), winRead_(0), winWrite_(0) {}
   /**
    * writeError is set to true if an error occurs during a write().
    * Set writeError to false before calling print() and/or write() and check
@@ -202,6 +325,12 @@ class SdFile : public Print {
   /** \return Index of this file's directory in the block dirBlock. */
   uint8_t dirIndex(void) const {return dirIndex_;}
   static void dirName(const dir_t& dir, char* name);
+  /**
+   * \return The length of the start of the file known to be on the card
+   * along with its directory entry.  Set by sync() and lowered by a write
+   * before that offset.  Data past it may be lost on power failure.
+   */
+  uint32_t durableSize(void) const {return syncedSize_;}
   /** \return The total number of bytes in a file or directory. */
   uint32_t fileSize(void) const {return fileSize_;}
   /** \return The first cluster number for a file or directory. */
@@ -224,27 +353,21 @@ class SdFile : public Print {
   uint8_t open(SdFile* dirFile, const char* fileName, uint8_t oflag);
 
   uint8_t openRoot(SdVolume* vol);
+  int16_t peek(void);
   static void printDirName(const dir_t& dir, uint8_t width);
   static void printFatDate(uint16_t fatDate);
   static void printFatTime(uint16_t fatTime);
   static void printTwoDigits(uint8_t v);
-  /**
-   * Read the next byte from a file.
-   *
-   * \return For success read returns the next byte in the file as an int.
-   * If an error occurs or end of file is reached -1 is returned.
-   */
-  int16_t read(void) {
-    uint8_t b;
-    return read(&b, 1) == 1 ? b : -1;
-  }
+  int16_t read(void);
   int16_t read(void* buf, uint16_t nbyte);
   int8_t readDir(dir_t* dir);
+  int8_t readDirIndex(dir_t* dir, uint16_t* index);
   static uint8_t remove(SdFile* dirFile, const char* fileName);
   uint8_t remove(void);
   /** Set the file's current position to zero. */
   void rewind(void) {
     curPosition_ = curCluster_ = 0;
+    winWrite_ = 0;
   }
   uint8_t rmDir(void);
   uint8_t rmRfStar(void);
@@ -267,9 +390,37 @@ class SdFile : public Print {
   void setUnbufferedRead(void) {
     if (isFile()) flags_ |= F_FILE_UNBUFFERED_READ;
   }
+  /**
+   * Set the write-behind policy for all files.  write() calls sync() once
+   * any of the limits is reached, so directory entry, FAT and data updates
+   * are written together.  A zero limit is not checked.  All zero, the
+   * default, leaves sync() to the application.  O_SYNC still syncs every
+   * write.
+   *
+   * \param[in] bytes Bytes written since the last sync().
+   * \param[in] blocks Data blocks filled since the last sync().
+   * \param[in] ms Milliseconds since the first write after the last
+   * sync().  Call syncBehind() from loop() so this applies when writes stop.
+   */
+  static void setWriteBehind(uint32_t bytes, uint16_t blocks,
+                             uint16_t ms) {
+    behindBytes_ = bytes;
+    behindBlocks_ = blocks;
+    behindMillis_ = ms;
+  }
+  /**
+   * Write a file made by createContiguous() as a raw log.  Data goes to the
+   * preallocated blocks in order with no FAT or directory updates.  A write
+   * past the preallocated size fails.  close() truncates the file to the
+   * current position, which is the only FAT update.
+   */
+  void setRawLog(void) {
+    if (isFile()) flags_ |= F_FILE_RAW_LOG;
+  }
   uint8_t timestamp(uint8_t flag, uint16_t year, uint8_t month, uint8_t day,
           uint8_t hour, uint8_t minute, uint8_t second);
   uint8_t sync(void);
+  uint8_t syncBehind(void);
   /** Type of this SdFile.  You should use isFile() or isDir() instead of type()
    * if possible.
    *
@@ -375,14 +526,19 @@ class SdFile : public Print {
   // should be 0XF
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
   // available bits
-  static uint8_t const F_UNUSED = 0X30;
+  static uint8_t const F_UNUSED = 0;
+  // preallocated file is written as a raw log
+  static uint8_t const F_FILE_RAW_LOG = 0X20;
+  // last mapped cluster is end of chain
+  static uint8_t const F_FILE_MAP_EOC = 0X10;
   // use unbuffered SD read
   static uint8_t const F_FILE_UNBUFFERED_READ = 0X40;
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
 
 // make sure F_OFLAG is ok
-#if ((F_UNUSED | F_FILE_UNBUFFERED_READ | F_FILE_DIR_DIRTY) & F_OFLAG)
+#if ((F_UNUSED | F_FILE_RAW_LOG | F_FILE_MAP_EOC | F_FILE_UNBUFFERED_READ\
+  | F_FILE_DIR_DIRTY) & F_OFLAG)
 #error flags_ bits conflict
 #endif  // flags_ bits
 
@@ -396,15 +552,82 @@ class SdFile : public Print {
   uint32_t  fileSize_;      // file size in bytes
   uint32_t  firstCluster_;  // first cluster of file
   SdVolume* vol_;           // volume where file is located
+  uint8_t   extCount_;      // number of extents in map
+  uint32_t  extMapped_;     // number of clusters covered by map
+  uint32_t  extStart_[SD_FILE_EXTENT_COUNT];    // file index of extent
+  uint32_t  extCluster_[SD_FILE_EXTENT_COUNT];  // first cluster of extent
+  uint32_t  syncedSize_;    // bytes of file on SD as of last sync
+  uint32_t  unsyncedBytes_;   // bytes written since last sync
+  uint16_t  unsyncedBlocks_;  // blocks filled since last sync
+  uint16_t  unsyncedTime_;    // millis() at first write since last sync
+  // Window onto the cached block at the file position for single byte
+  // read(), peek() and write().  It starts one byte into the block so the
+  // first byte of each block goes through the full read or write path.
+  cacheSlot_t* winSlot_;    // cache slot that held the block
+  uint32_t  winBlock_;      // SD block, the window is stale if winSlot_ moved
+  uint32_t  winStart_;      // file position of winSlot_->buf.data[1]
+  uint16_t  winRead_;       // bytes from winStart_ read() may take
+  uint16_t  winWrite_;      // bytes from winStart_ write() may replace
+#if SD_EXFAT_SUPPORT
+  uint32_t  setBlock_;      // block with the last entry of the exFAT set
+  uint8_t   setCount_;      // entries in the exFAT set, dirBlock_ has the first
+  uint8_t   exFlags_;       // EXFAT_FLAG_ bits, zero for FAT
+#endif  // SD_EXFAT_SUPPORT
+
+  static uint32_t behindBytes_;   // write-behind limits, zero if not used
+  static uint16_t behindBlocks_;
+  static uint16_t behindMillis_;
+
+  static dirLookup_t lookup_[SD_DIR_LOOKUP_COUNT];  // recently opened entries
+  static uint8_t lookupNext_;  // next lookup_ entry to replace
+#if SD_DIR_INDEX_SIZE
+  // hash index for one directory
+  static uint32_t indexBlock_[SD_DIR_INDEX_SIZE/16];  // block of each 16
+  static uint32_t indexCandidate_;  // last directory with a long search
+  static uint32_t indexCluster_;  // first cluster of indexed directory
+  static uint16_t indexCount_;    // entries in directory, zero if no index
+  static uint16_t indexEnd_;      // entries before first DIR_NAME_FREE
+  static uint8_t indexHash_[SD_DIR_INDEX_SIZE];  // name hash, zero if free
+#endif  // SD_DIR_INDEX_SIZE
 
   // private functions
   uint8_t addCluster(void);
   uint8_t addDirCluster(void);
   dir_t* cacheDirEntry(uint8_t action);
+#if SD_DIR_INDEX_SIZE
+  uint8_t dirIndexBuild(void);
+  int8_t dirIndexFind(SdFile* dirFile, const uint8_t* dname,
+                      uint8_t* emptyFound);
+  static uint8_t dirIndexHash(const uint8_t* name);
+  static void dirIndexScanned(SdFile* dirFile);
+  static void dirIndexSet(uint32_t block, uint8_t index, uint8_t hash);
+#endif  // SD_DIR_INDEX_SIZE
   static void (*dateTime_)(uint16_t* date, uint16_t* time);
+  uint8_t extentAdd(uint32_t index, uint32_t cluster);
+#if SD_EXFAT_SUPPORT
+  uint8_t exFatChecksum(void);
+  static void exFatDir(const exFatSet_t& set, dir_t* dir);
+  void* exFatEntry(uint8_t i, uint8_t action);
+  uint8_t exFatMakeChain(uint32_t last);
+  static uint16_t exFatNameHash(const uint8_t* name, uint8_t length);
+  uint8_t exFatOpen(SdFile* dirFile, const char* fileName,
+                    const uint8_t* dname, uint8_t oflag);
+  uint8_t exFatOpenSet(const exFatSet_t& set, uint8_t oflag);
+  int8_t exFatReadSet(exFatSet_t* set);
+  uint8_t exFatRemove(void);
+  uint8_t exFatSync(void);
+#endif  // SD_EXFAT_SUPPORT
+  uint32_t extentCluster(uint32_t index) const;
+  uint32_t extentRun(uint32_t index) const;
+  void extentReset(void);
+  void lookupAdd(uint32_t dirCluster, const uint8_t* name);
+  static dirLookup_t* lookupFind(uint32_t dirCluster, const uint8_t* name);
   static uint8_t make83Name(const char* str, uint8_t* name);
+  uint8_t nextCluster(uint32_t index, uint32_t* cluster);
   uint8_t openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
+  uint32_t preEraseCount(uint16_t blockOfCluster, uint32_t nToWrite);
   dir_t* readDirCache(void);
+  uint8_t winPut(uint8_t b);
 };
 //==============================================================================
 // SdVolume class
@@ -424,23 +647,51 @@ union cache_t {
   mbr_t    mbr;
            /** Used to access to a cached FAT boot sector. */
   fbs_t    fbs;
+           /** Used to access to a cached exFAT boot sector. */
+  exfbs_t  exfbs;
 };
 //------------------------------------------------------------------------------
+/**
+ * \brief One slot of the SdVolume block cache
+ */
+struct cacheSlot_t {
+           /** Cached block data. */
+  cache_t  buf;
+           /** Logical number of the cached block or 0XFFFFFFFF if empty. */
+  uint32_t blockNumber;
+           /** Second FAT block to be written with this block or zero. */
+  uint32_t mirrorBlock;
+           /** cacheFlush() will write the block if nonzero. */
+  uint8_t  dirty;
+           /** Replacement priority of the block. Lowest is evicted first. */
+  uint8_t  priority;
+           /** Least recently used rank.  Zero for the most recent slot. */
+  uint8_t  age;
+};
+//------------------------------------------------------------------------------
+// values for SdVolume::setFatMirror()
+/** write the second FAT with each FAT block, the default */
+uint8_t const FAT_MIRROR_WRITE = 0;
+/** write the second FAT when a file is synced or closed */
+uint8_t const FAT_MIRROR_DEFER = 1;
+/** don't write the second FAT, it becomes stale */
+uint8_t const FAT_MIRROR_OFF = 2;
+//------------------------------------------------------------------------------
 /**
  * \class SdVolume
- * \brief Access FAT16 and FAT32 volumes on SD and SDHC cards.
+ * \brief Access FAT16, FAT32 and exFAT volumes on SD, SDHC and SDXC cards.
  */
 class SdVolume {
  public:
   /** Create an instance of SdVolume */
-  SdVolume(void) :allocSearchStart_(2), fatType_(0) {}
+  SdVolume(void) :allocSearchStart_(2), fatType_(0), freeClusterCount_(-1) {}
   /** Clear the cache and returns a pointer to the cache.  Used by the WaveRP
    *  recorder to do raw write to the SD card.  Not for normal apps.
    */
   static uint8_t* cacheClear(void) {
     cacheFlush();
-    cacheBlockNumber_ = 0XFFFFFFFF;
-    return cacheBuffer_.data;
+    cacheCurrent_->blockNumber = 0XFFFFFFFF;
+    return cacheCurrent_->buf.data;
   }
   /**
    * Initialize a FAT volume.  Try partition one first then try super
@@ -458,7 +709,7 @@ class SdVolume {
 
   // inline functions that return volume info
   /** \return The volume's cluster size in blocks. */
-  uint8_t blocksPerCluster(void) const {return blocksPerCluster_;}
+  uint16_t blocksPerCluster(void) const {return blocksPerCluster_;}
   /** \return The number of blocks in one FAT. */
   uint32_t blocksPerFat(void)  const {return blocksPerFat_;}
   /** \return The total number of clusters in the volume. */
@@ -471,8 +722,13 @@ class SdVolume {
   uint8_t fatCount(void) const {return fatCount_;}
   /** \return The logical block number for the start of the first FAT. */
   uint32_t fatStartBlock(void) const {return fatStartBlock_;}
-  /** \return The FAT type of the volume. Values are 12, 16 or 32. */
+  int32_t freeClusterCount(void);
+  /** \return The FAT type of the volume. Values are 12, 16, 32 or 64 for
+   * exFAT. */
   uint8_t fatType(void) const {return fatType_;}
+  /** \return The second FAT mode. See setFatMirror(). */
+  static uint8_t fatMirror(void) {return fatMirror_;}
+  static uint8_t fatMirrorFlush(void);
   /** \return The number of entries in the root directory for FAT16 volumes. */
   uint32_t rootDirEntryCount(void) const {return rootDirEntryCount_;}
   /** \return The logical block number for the start of the root directory
@@ -480,6 +736,7 @@ class SdVolume {
   uint32_t rootDirStart(void) const {return rootDirStart_;}
   /** return a pointer to the Sd2Card object for this volume */
   static Sd2Card* sdCard(void) {return sdCard_;}
+  static uint8_t setFatMirror(uint8_t mode);
 //------------------------------------------------------------------------------
 #if ALLOW_DEPRECATED_FUNCTIONS
   // Deprecated functions  - suppress cpplint warnings with NOLINT comment
@@ -500,52 +757,111 @@ class SdVolume {
   static uint8_t const CACHE_FOR_READ = 0;
   // value for action argument in cacheRawBlock to indicate cache dirty
   static uint8_t const CACHE_FOR_WRITE = 1;
+  // action bit for cacheRawBlock to skip the read of a block to be replaced
+  static uint8_t const CACHE_OPTION_NO_READ = 2;
+  // value for action argument in cacheRawBlock to reserve a block for write
+  static uint8_t const CACHE_RESERVE_FOR_WRITE =
+                       CACHE_FOR_WRITE | CACHE_OPTION_NO_READ;
+
+  // priority hints for cacheRawBlock - lowest priority is evicted first
+  static uint8_t const CACHE_PRIORITY_DATA = 0;
+  static uint8_t const CACHE_PRIORITY_DIR = 1;
+  static uint8_t const CACHE_PRIORITY_FAT = 2;
 
-  static cache_t cacheBuffer_;        // 512 byte cache for device blocks
-  static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
+  static cacheSlot_t cacheSlot_[SD_CACHE_SLOT_COUNT];  // block cache
+  static cacheSlot_t* cacheCurrent_;  // slot used by last cacheRawBlock()
   static Sd2Card* sdCard_;            // Sd2Card object for cache
-  static uint8_t cacheDirty_;         // cacheFlush() will write block if true
-  static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
+  static uint8_t fatMirror_;          // FAT_MIRROR_WRITE, DEFER or OFF
+  // FAT blocks whose second copy is stale, zero if unused
+  static uint32_t mirrorPending_[SD_FAT_MIRROR_PENDING];
+  static uint32_t mirrorOffset_;      // second FAT block - first FAT block
 //
   uint32_t allocSearchStart_;   // start cluster for alloc search
-  uint8_t blocksPerCluster_;    // cluster size in blocks
+#if SD_EXFAT_SUPPORT
+  uint32_t bitmapStartBlock_;   // first block of the exFAT allocation bitmap
+#endif  // SD_EXFAT_SUPPORT
+  uint16_t blocksPerCluster_;   // cluster size in blocks
   uint32_t blocksPerFat_;       // FAT size in blocks
   uint32_t clusterCount_;       // clusters in one FAT
   uint8_t clusterSizeShift_;    // shift to convert cluster count to block count
   uint32_t dataStartBlock_;     // first data block number
   uint8_t fatCount_;            // number of FATs on volume
   uint32_t fatStartBlock_;      // start block for first FAT
-  uint8_t fatType_;             // volume type (12, 16, OR 32)
+  uint8_t fatType_;             // volume type (12, 16, 32 OR 64 for exFAT)
+  int32_t freeClusterCount_;    // free clusters or -1 if not yet counted
+  uint8_t freeMap_[SD_FREE_MAP_SIZE];  // bit set if cluster group is full
+  uint8_t freeMapShift_;        // shift to convert cluster to group
   uint16_t rootDirEntryCount_;  // number of entries in FAT16 root dir
   uint32_t rootDirStart_;       // root start block for FAT16, cluster for FAT32
   //----------------------------------------------------------------------------
-  uint8_t allocContiguous(uint32_t count, uint32_t* curCluster);
-  uint8_t blockOfCluster(uint32_t position) const {
+  uint8_t allocContiguous(uint32_t count, uint32_t* curCluster,
+                          uint8_t fatChain = true);
+#if SD_EXFAT_SUPPORT
+  int32_t bitmapFreeCount(void);
+  uint8_t bitmapGet(uint32_t cluster, uint32_t* used) const;
+  uint8_t bitmapPut(uint32_t cluster, uint32_t count, uint8_t used);
+#endif  // SD_EXFAT_SUPPORT
+  uint16_t blockOfCluster(uint32_t position) const {
           return (position >> 9) & (blocksPerCluster_ - 1);}
   uint32_t clusterStartBlock(uint32_t cluster) const {
            return dataStartBlock_ + ((cluster - 2) << clusterSizeShift_);}
   uint32_t blockNumber(uint32_t cluster, uint32_t position) const {
            return clusterStartBlock(cluster) + blockOfCluster(position);}
+  static uint32_t cacheBlockNumber(void) {return cacheCurrent_->blockNumber;}
+  static cache_t* cacheBuffer(void) {return &cacheCurrent_->buf;}
+  static cacheSlot_t* cacheFind(uint32_t blockNumber);
   static uint8_t cacheFlush(void);
-  static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
-  static void cacheSetDirty(void) {cacheDirty_ |= CACHE_FOR_WRITE;}
+  static uint8_t cacheFlushSlot(cacheSlot_t* slot);
+  static void cacheInvalidate(uint32_t blockNumber);
+  static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action,
+                               uint8_t priority = CACHE_PRIORITY_DATA);
+  static void cacheSetDirty(void) {cacheCurrent_->dirty = CACHE_FOR_WRITE;}
   static uint8_t cacheZeroBlock(uint32_t blockNumber);
   uint8_t chainSize(uint32_t beginCluster, uint32_t* size) const;
   uint8_t fatGet(uint32_t cluster, uint32_t* value) const;
   uint8_t fatPut(uint32_t cluster, uint32_t value);
   uint8_t fatPutEOC(uint32_t cluster) {
-    return fatPut(cluster, 0x0FFFFFFF);
+    return fatPut(cluster, fatType_ == 64 ? EXFAT_EOC : 0x0FFFFFFF);
   }
   uint8_t freeChain(uint32_t cluster);
+#if SD_EXFAT_SUPPORT
+  uint8_t exFatInit(uint32_t volumeStartBlock);
+  uint8_t freeRange(uint32_t cluster, uint32_t count);
+#endif  // SD_EXFAT_SUPPORT
+  uint8_t freeMapFull(uint32_t cluster) const {
+    uint16_t g = cluster >> freeMapShift_;
+    return freeMap_[g >> 3] & (1 << (g & 7));
+  }
+  void freeMapSet(uint32_t cluster, uint8_t full) {
+    uint16_t g = cluster >> freeMapShift_;
+    if (full) {
+      freeMap_[g >> 3] |= 1 << (g & 7);
+    } else {
+      freeMap_[g >> 3] &= ~(1 << (g & 7));
+    }
+  }
   uint8_t isEOC(uint32_t cluster) const {
+    // exFAT has no reserved values below the end of chain marker
+    if (fatType_ == 64) return cluster > clusterCount_ + 1;
     return  cluster >= (fatType_ == 16 ? FAT16EOC_MIN : FAT32EOC_MIN);
   }
+  /** \return True for an exFAT volume. */
+  uint8_t isExFat(void) const {return fatType_ == 64;}
+  static uint8_t mirrorDefer(uint32_t blockNumber);
   uint8_t readBlock(uint32_t block, uint8_t* dst) {
     return sdCard_->readBlock(block, dst);}
   uint8_t readData(uint32_t block, uint16_t offset,
     uint16_t count, uint8_t* dst) {
       return sdCard_->readData(block, offset, count, dst);
   }
+  uint8_t streamRead(uint32_t block, uint8_t* dst) {
+    return sdCard_->streamRead(block, dst);
+  }
+  static uint8_t streamStop(void) {return sdCard_->streamStop();}
+  uint8_t streamWrite(uint32_t block, const uint8_t* src,
+                      uint32_t eraseCount) {
+    return sdCard_->streamWrite(block, src, eraseCount);
+  }
   uint8_t writeBlock(uint32_t block, const uint8_t* dst) {
     return sdCard_->writeBlock(block, dst);
   }
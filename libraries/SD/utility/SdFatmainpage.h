@@ -35,7 +35,8 @@ The main classes in SdFat are Sd2Card, SdVolume, and SdFile.
 The Sd2Card class supports access to standard SD cards and SDHC cards.  Most
 applications will only need to call the Sd2Card::init() member function.
 
-The SdVolume class supports FAT16 and FAT32 partitions.  Most applications
+The SdVolume class supports FAT16 and FAT32 partitions, and exFAT partitions
+as used on SDXC cards when SD_EXFAT_SUPPORT is non-zero.  Most applications
 will only need to call the SdVolume::init() member function.
 
 The SdFile class provides file access functions such as open(), read(),
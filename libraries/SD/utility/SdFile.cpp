@@ -27,6 +27,24 @@
 //------------------------------------------------------------------------------
 // callback function for date/time
 void (*SdFile::dateTime_)(uint16_t* date, uint16_t* time) = NULL;
+// write-behind policy, see setWriteBehind()
+uint32_t SdFile::behindBytes_ = 0;
+uint16_t SdFile::behindBlocks_ = 0;
+uint16_t SdFile::behindMillis_ = 0;
+
+// recently opened directory entries - cleared by openRoot()
+dirLookup_t SdFile::lookup_[SD_DIR_LOOKUP_COUNT];
+uint8_t SdFile::lookupNext_ = 0;
+
+#if SD_DIR_INDEX_SIZE
+// hash index for one directory - indexCount_ is zero if no index
+uint32_t SdFile::indexBlock_[SD_DIR_INDEX_SIZE/16];
+uint32_t SdFile::indexCluster_;
+uint32_t SdFile::indexCandidate_ = 0XFFFFFFFF;
+uint16_t SdFile::indexCount_ = 0;
+uint16_t SdFile::indexEnd_;
+uint8_t  SdFile::indexHash_[SD_DIR_INDEX_SIZE];
+#endif  // SD_DIR_INDEX_SIZE
 
 #if ALLOW_DEPRECATED_FUNCTIONS
 // suppress cpplint warnings with NOLINT comment
@@ -35,7 +53,23 @@ void (*SdFile::oldDateTime_)(uint16_t& date, uint16_t& time) = NULL;  // NOLINT
 //------------------------------------------------------------------------------
 // add a cluster to a file
 uint8_t SdFile::addCluster() {
+  uint32_t last = curCluster_;
+#if SD_EXFAT_SUPPORT
+  // a contiguous exFAT file has no FAT chain until it stops being contiguous
+  uint8_t fatChain = !(exFlags_ & EXFAT_FLAG_NO_FAT_CHAIN);
+  if (!vol_->allocContiguous(1, &curCluster_, fatChain)) return false;
+  if (!fatChain && last && curCluster_ != last + 1) {
+    if (!exFatMakeChain(last)) return false;
+  }
+#else  // SD_EXFAT_SUPPORT
   if (!vol_->allocContiguous(1, &curCluster_)) return false;
+#endif  // SD_EXFAT_SUPPORT
+
+  // extend extent map if it ends at the old end of chain
+  uint8_t atEnd = last == 0 ? extMapped_ == 0 : (flags_ & F_FILE_MAP_EOC)
+                  && extentCluster(extMapped_ - 1) == last;
+  flags_ &= ~F_FILE_MAP_EOC;
+  if (atEnd && extentAdd(extMapped_, curCluster_)) flags_ |= F_FILE_MAP_EOC;
 
   // if first cluster of file link to directory entry
   if (firstCluster_ == 0) {
@@ -52,19 +86,24 @@ uint8_t SdFile::addDirCluster(void) {
 
   // zero data in cluster insure first cluster is in cache
   uint32_t block = vol_->clusterStartBlock(curCluster_);
-  for (uint8_t i = vol_->blocksPerCluster_; i != 0; i--) {
+  for (uint16_t i = vol_->blocksPerCluster_; i != 0; i--) {
     if (!SdVolume::cacheZeroBlock(block + i - 1)) return false;
   }
   // Increase directory file size by cluster size
   fileSize_ += 512UL << vol_->clusterSizeShift_;
+#if SD_EXFAT_SUPPORT
+  // an exFAT subdirectory's size is in its entry set
+  if (vol_->isExFat() && !isRoot()) flags_ |= F_FILE_DIR_DIRTY;
+#endif  // SD_EXFAT_SUPPORT
   return true;
 }
 //------------------------------------------------------------------------------
 // cache a file's directory entry
 // return pointer to cached entry or null for failure
 dir_t* SdFile::cacheDirEntry(uint8_t action) {
-  if (!SdVolume::cacheRawBlock(dirBlock_, action)) return NULL;
-  return SdVolume::cacheBuffer_.dir + dirIndex_;
+  if (!SdVolume::cacheRawBlock(dirBlock_, action,
+                               SdVolume::CACHE_PRIORITY_DIR)) return NULL;
+  return SdVolume::cacheBuffer()->dir + dirIndex_;
 }
 //------------------------------------------------------------------------------
 /**
@@ -76,7 +115,13 @@ dir_t* SdFile::cacheDirEntry(uint8_t action) {
  * Reasons for failure include no file is open or an I/O error.
  */
 uint8_t SdFile::close(void) {
+  // free preallocated clusters past end of log
+  if (flags_ & F_FILE_RAW_LOG) {
+    flags_ &= ~F_FILE_RAW_LOG;
+    if (!truncate(curPosition_)) return false;
+  }
   if (!sync())return false;
+  winRead_ = 0;
   type_ = FAT_FILE_TYPE_CLOSED;
   return true;
 }
@@ -96,20 +141,18 @@ uint8_t SdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
   // error if no blocks
   if (firstCluster_ == 0) return false;
 
-  for (uint32_t c = firstCluster_; ; c++) {
-    uint32_t next;
-    if (!vol_->fatGet(c, &next)) return false;
-
-    // check for contiguous
-    if (next != (c + 1)) {
-      // error if not end of chain
-      if (!vol_->isEOC(next)) return false;
-      *bgnBlock = vol_->clusterStartBlock(firstCluster_);
-      *endBlock = vol_->clusterStartBlock(c)
-                  + vol_->blocksPerCluster_ - 1;
-      return true;
-    }
+  // extend the extent map to end of chain or a second extent
+  uint32_t c = extentCluster(extMapped_ - 1);
+  while (extCount_ == 1 && !(flags_ & F_FILE_MAP_EOC)) {
+    if (!nextCluster(extMapped_, &c)) return false;
   }
+  // error if not contiguous
+  if (extCount_ != 1) return false;
+
+  *bgnBlock = vol_->clusterStartBlock(firstCluster_);
+  *endBlock = vol_->clusterStartBlock(firstCluster_ + extMapped_ - 1)
+              + vol_->blocksPerCluster_ - 1;
+  return true;
 }
 //------------------------------------------------------------------------------
 /**
@@ -139,13 +182,30 @@ uint8_t SdFile::createContiguous(SdFile* dirFile,
   // calculate number of clusters needed
   uint32_t count = ((size - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
 
-  // allocate clusters
+  // allocate clusters, an exFAT file doesn't need a FAT chain
+#if SD_EXFAT_SUPPORT
+  if (!vol_->allocContiguous(count, &firstCluster_, !vol_->isExFat())) {
+    remove();
+    return false;
+  }
+#else  // SD_EXFAT_SUPPORT
   if (!vol_->allocContiguous(count, &firstCluster_)) {
     remove();
     return false;
   }
+#endif  // SD_EXFAT_SUPPORT
   fileSize_ = size;
 
+  // erase ahead of writes, not all cards can erase single blocks
+  uint32_t bgnBlock = vol_->clusterStartBlock(firstCluster_);
+  vol_->sdCard()->erase(bgnBlock,
+                        bgnBlock + (count << vol_->clusterSizeShift_) - 1);
+
+  // whole file is one extent
+  extentReset();
+  extMapped_ = count;
+  flags_ |= F_FILE_MAP_EOC;
+
   // insure sync() will update dir entry
   flags_ |= F_FILE_DIR_DIRTY;
   return sync();
@@ -157,11 +217,15 @@ uint8_t SdFile::createContiguous(SdFile* dirFile,
  * \param[out] dir Location for return of the files directory entry.
  *
  * \return The value one, true, is returned for success and
- * the value zero, false, is returned for failure.
+ * the value zero, false, is returned for failure.  An exFAT file has no
+ * FAT directory entry so this fails on an exFAT volume.
  */
 uint8_t SdFile::dirEntry(dir_t* dir) {
   // make sure fields on SD are correct
   if (!sync()) return false;
+#if SD_EXFAT_SUPPORT
+  if (vol_->isExFat()) return false;
+#endif  // SD_EXFAT_SUPPORT
 
   // read entry
   dir_t* p = cacheDirEntry(SdVolume::CACHE_FOR_READ);
@@ -188,6 +252,149 @@ void SdFile::dirName(const dir_t& dir, char* name) {
   }
   name[j] = 0;
 }
+#if SD_DIR_INDEX_SIZE
+//------------------------------------------------------------------------------
+// Index all entries of this directory.  Reads every block of the directory.
+uint8_t SdFile::dirIndexBuild(void) {
+  indexCount_ = 0;
+  indexEnd_ = 0;
+  uint8_t atEnd = false;
+  rewind();
+  for (uint16_t i = 0; curPosition_ < fileSize_; i++) {
+    dir_t* p = readDirCache();
+    if (p == NULL) return false;
+    if ((i & 0XF) == 0) indexBlock_[i >> 4] = SdVolume::cacheBlockNumber();
+
+    // no used entries follow a free entry
+    if (p->name[0] == DIR_NAME_FREE) atEnd = true;
+    if (atEnd || p->name[0] == DIR_NAME_DELETED) {
+      indexHash_[i] = 0;
+    } else {
+      indexHash_[i] = dirIndexHash(p->name);
+      indexEnd_ = i + 1;
+    }
+  }
+  indexCluster_ = firstCluster_;
+  indexCount_ = fileSize_ >> 5;
+  return true;
+}
+//------------------------------------------------------------------------------
+// Search the directory index for dname.  Returns one if found with the
+// entry in the cache and zero if dname is not in dirFile, emptyFound is
+// set if a free entry is available.  Returns -1 if there is no index.
+int8_t SdFile::dirIndexFind(SdFile* dirFile, const uint8_t* dname,
+                            uint8_t* emptyFound) {
+  if (indexCount_ == 0 || indexCluster_ != dirFile->firstCluster_) return -1;
+  uint8_t hash = dirIndexHash(dname);
+  for (uint16_t i = 0; i < indexEnd_; i++) {
+    if (indexHash_[i] != hash) continue;
+    if (!SdVolume::cacheRawBlock(indexBlock_[i >> 4],
+      SdVolume::CACHE_FOR_READ, SdVolume::CACHE_PRIORITY_DIR)) return -1;
+    dir_t* p = SdVolume::cacheBuffer()->dir + (i & 0XF);
+    if (!memcmp(dname, p->name, 11)) {
+      dirIndex_ = i & 0XF;
+      return 1;
+    }
+  }
+  // use first deleted entry or first entry past end
+  for (uint16_t i = 0; i < indexCount_; i++) {
+    if (indexHash_[i] == 0) {
+      *emptyFound = true;
+      dirBlock_ = indexBlock_[i >> 4];
+      dirIndex_ = i & 0XF;
+      break;
+    }
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+// hash of an 8.3 name, never zero
+uint8_t SdFile::dirIndexHash(const uint8_t* name) {
+  uint8_t h = 0;
+  for (uint8_t i = 0; i < 11; i++) h = ((h << 1) | (h >> 7)) ^ name[i];
+  return h ? h : 1;
+}
+//------------------------------------------------------------------------------
+// Index a directory the second time in a row a search goes past its
+// second block.  Two large directories used in turn are not indexed so
+// the index doesn't thrash.
+void SdFile::dirIndexScanned(SdFile* dirFile) {
+  if (dirFile->curPosition_ <= 1024) return;
+  if (dirFile->fileSize_ > 32UL * SD_DIR_INDEX_SIZE) return;
+  if (indexCandidate_ != dirFile->firstCluster_) {
+    indexCandidate_ = dirFile->firstCluster_;
+    return;
+  }
+  dirFile->dirIndexBuild();
+}
+//------------------------------------------------------------------------------
+// update the index for a changed entry, hash is zero for a removed entry
+void SdFile::dirIndexSet(uint32_t block, uint8_t index, uint8_t hash) {
+  for (uint16_t k = 0; k < (indexCount_ >> 4); k++) {
+    if (indexBlock_[k] == block) {
+      uint16_t i = (k << 4) | index;
+      indexHash_[i] = hash;
+      if (hash && i >= indexEnd_) indexEnd_ = i + 1;
+      return;
+    }
+  }
+}
+#endif  // SD_DIR_INDEX_SIZE
+//------------------------------------------------------------------------------
+// Record that cluster is at index in the file.  The map only grows at its
+// end.  Return false if the cluster was not recorded.
+uint8_t SdFile::extentAdd(uint32_t index, uint32_t cluster) {
+  if (index != extMapped_) return false;
+  if (extCount_ != 0) {
+    // extend last extent if cluster is contiguous
+    uint8_t i = extCount_ - 1;
+    if (cluster == extCluster_[i] + index - extStart_[i]) {
+      extMapped_++;
+      return true;
+    }
+  }
+  if (extCount_ == SD_FILE_EXTENT_COUNT) return false;
+  extStart_[extCount_] = index;
+  extCluster_[extCount_] = cluster;
+  extCount_++;
+  extMapped_++;
+  return true;
+}
+//------------------------------------------------------------------------------
+// return the cluster at index in the file or zero if it is not mapped
+uint32_t SdFile::extentCluster(uint32_t index) const {
+  if (index >= extMapped_) return 0;
+  uint8_t i = extCount_ - 1;
+  while (extStart_[i] > index) i--;
+  return extCluster_[i] + index - extStart_[i];
+}
+//------------------------------------------------------------------------------
+// return the number of mapped clusters contiguous from index, zero if the
+// cluster at index is not mapped
+uint32_t SdFile::extentRun(uint32_t index) const {
+  if (index >= extMapped_) return 0;
+  uint8_t i = extCount_ - 1;
+  while (extStart_[i] > index) i--;
+  uint32_t end = i + 1 < extCount_ ? extStart_[i + 1] : extMapped_;
+  return end - index;
+}
+//------------------------------------------------------------------------------
+// clear the extent map and start it with the first cluster
+void SdFile::extentReset(void) {
+  extCount_ = 0;
+  extMapped_ = 0;
+  flags_ &= ~F_FILE_MAP_EOC;
+  if (firstCluster_) extentAdd(0, firstCluster_);
+#if SD_EXFAT_SUPPORT
+  // a contiguous exFAT file is one extent of its size
+  if (firstCluster_ && (exFlags_ & EXFAT_FLAG_NO_FAT_CHAIN)) {
+    if (fileSize_) {
+      extMapped_ = ((fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
+    }
+    flags_ |= F_FILE_MAP_EOC;
+  }
+#endif  // SD_EXFAT_SUPPORT
+}
 //------------------------------------------------------------------------------
 /** List directory contents to Serial.
  *
@@ -203,46 +410,63 @@ void SdFile::dirName(const dir_t& dir, char* name) {
  * list to indicate subdirectory level.
  */
 void SdFile::ls(uint8_t flags, uint8_t indent) {
-  dir_t* p;
+  dir_t d;
+  uint16_t index;
 
   rewind();
-  while ((p = readDirCache())) {
-    // done if past last used entry
-    if (p->name[0] == DIR_NAME_FREE) break;
-
-    // skip deleted entry and entries for . and  ..
-    if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') continue;
-
-    // only list subdirectories and files
-    if (!DIR_IS_FILE_OR_SUBDIR(p)) continue;
-
+  while (readDirIndex(&d, &index) > 0) {
     // print any indent spaces
     for (int8_t i = 0; i < indent; i++) Serial.print(' ');
 
     // print file name with possible blank fill
-    printDirName(*p, flags & (LS_DATE | LS_SIZE) ? 14 : 0);
+    printDirName(d, flags & (LS_DATE | LS_SIZE) ? 14 : 0);
 
     // print modify date/time if requested
     if (flags & LS_DATE) {
-       printFatDate(p->lastWriteDate);
+       printFatDate(d.lastWriteDate);
        Serial.print(' ');
-       printFatTime(p->lastWriteTime);
+       printFatTime(d.lastWriteTime);
     }
     // print size if requested
-    if (!DIR_IS_SUBDIR(p) && (flags & LS_SIZE)) {
+    if (!DIR_IS_SUBDIR(&d) && (flags & LS_SIZE)) {
       Serial.print(' ');
-      Serial.print(p->fileSize);
+      Serial.print(d.fileSize);
     }
     Serial.println();
 
     // list subdirectory content if requested
-    if ((flags & LS_R) && DIR_IS_SUBDIR(p)) {
-      uint16_t index = curPosition()/32 - 1;
+    if ((flags & LS_R) && DIR_IS_SUBDIR(&d)) {
+      uint32_t pos = curPosition_;
       SdFile s;
       if (s.open(this, index, O_READ)) s.ls(flags, indent + 2);
-      seekSet(32 * (index + 1));
+      seekSet(pos);
+    }
+  }
+}
+//------------------------------------------------------------------------------
+// remember location of this file's directory entry
+void SdFile::lookupAdd(uint32_t dirCluster, const uint8_t* name) {
+  dirLookup_t* e = lookupFind(dirCluster, name);
+  if (!e) {
+    e = &lookup_[lookupNext_];
+    if (++lookupNext_ >= SD_DIR_LOOKUP_COUNT) lookupNext_ = 0;
+  }
+  e->dirCluster = dirCluster;
+  e->block = dirBlock_;
+  e->index = dirIndex_;
+  memcpy(e->name, name, 11);
+}
+//------------------------------------------------------------------------------
+// find a remembered entry, returns NULL if name is not in the list
+dirLookup_t* SdFile::lookupFind(uint32_t dirCluster, const uint8_t* name) {
+  for (uint8_t i = 0; i < SD_DIR_LOOKUP_COUNT; i++) {
+    dirLookup_t* e = &lookup_[i];
+    if (e->block && e->dirCluster == dirCluster
+      && !memcmp(e->name, name, 11)) {
+      return e;
     }
   }
+  return NULL;
 }
 //------------------------------------------------------------------------------
 // format directory name field from a 8.3 name string
@@ -297,6 +521,16 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
 
   // allocate and zero first cluster
   if (!addDirCluster())return false;
+#if SD_EXFAT_SUPPORT
+  if (vol_->isExFat()) {
+    // an exFAT directory has no entries for '.' and '..'
+    exFile_t* f = static_cast<exFile_t*>(
+                    exFatEntry(0, SdVolume::CACHE_FOR_WRITE));
+    if (!f) return false;
+    f->attributes = DIR_ATT_DIRECTORY;
+    return sync();
+  }
+#endif  // SD_EXFAT_SUPPORT
 
   // force entry to SD
   if (!sync()) return false;
@@ -315,10 +549,11 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
 
   // cache block for '.'  and '..'
   uint32_t block = vol_->clusterStartBlock(firstCluster_);
-  if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
+  if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE,
+                               SdVolume::CACHE_PRIORITY_DIR)) return false;
 
   // copy '.' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[0], &d, sizeof(d));
+  memcpy(&SdVolume::cacheBuffer()->dir[0], &d, sizeof(d));
 
   // make entry for '..'
   d.name[1] = '.';
@@ -330,7 +565,7 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
     d.firstClusterHigh = dir->firstCluster_ >> 16;
   }
   // copy '..' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[1], &d, sizeof(d));
+  memcpy(&SdVolume::cacheBuffer()->dir[1], &d, sizeof(d));
 
   // set position after '..'
   curPosition_ = 2 * sizeof(d);
@@ -339,6 +574,25 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
   return SdVolume::cacheFlush();
 }
 //------------------------------------------------------------------------------
+// Set cluster to the cluster at index in the file.  On entry cluster is the
+// cluster at index - 1.  Returns an end of chain value past the last cluster.
+uint8_t SdFile::nextCluster(uint32_t index, uint32_t* cluster) {
+  uint32_t c = extentCluster(index);
+  if (c) {
+    *cluster = c;
+  } else if (index == extMapped_ && (flags_ & F_FILE_MAP_EOC)) {
+    *cluster = 0X0FFFFFFF;
+  } else {
+    if (!vol_->fatGet(*cluster, cluster)) return false;
+    if (!vol_->isEOC(*cluster)) {
+      extentAdd(index, *cluster);
+    } else if (index == extMapped_) {
+      flags_ |= F_FILE_MAP_EOC;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Open a file or directory by name.
  *
@@ -394,11 +648,48 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
 
   if (!make83Name(fileName, dname)) return false;
   vol_ = dirFile->vol_;
-  dirFile->rewind();
-
+#if SD_EXFAT_SUPPORT
+  if (vol_->isExFat()) return exFatOpen(dirFile, fileName, dname, oflag);
+#endif  // SD_EXFAT_SUPPORT
+
+  // try the remembered location before searching the directory
+  dirLookup_t* e = lookupFind(dirFile->firstCluster_, dname);
+  if (e) {
+    if (SdVolume::cacheRawBlock(e->block, SdVolume::CACHE_FOR_READ,
+                                SdVolume::CACHE_PRIORITY_DIR)) {
+      p = SdVolume::cacheBuffer()->dir + e->index;
+      if (!memcmp(dname, p->name, 11)) {
+        // don't open existing file if O_CREAT and O_EXCL
+        if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+        return openCachedEntry(e->index, oflag);
+      }
+    }
+    // entry has moved
+    e->block = 0;
+  }
   // bool for empty entry found
   uint8_t emptyFound = false;
 
+#if SD_DIR_INDEX_SIZE
+  // use hash index for a large directory
+  int8_t indexed = dirIndexFind(dirFile, dname, &emptyFound);
+  if (indexed > 0) {
+    // don't open existing file if O_CREAT and O_EXCL
+    if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+    if (!openCachedEntry(dirIndex_, oflag)) return false;
+    lookupAdd(dirFile->firstCluster_, dname);
+    return true;
+  }
+  // skip search if directory is indexed
+  if (indexed == 0) {
+    if (!dirFile->seekSet(dirFile->fileSize_)) return false;
+  } else {
+    dirFile->rewind();
+  }
+#else  // SD_DIR_INDEX_SIZE
+  dirFile->rewind();
+#endif  // SD_DIR_INDEX_SIZE
+
   // search for file
   while (dirFile->curPosition_ < dirFile->fileSize_) {
     uint8_t index = 0XF & (dirFile->curPosition_ >> 5);
@@ -410,7 +701,7 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
       if (!emptyFound) {
         emptyFound = true;
         dirIndex_ = index;
-        dirBlock_ = SdVolume::cacheBlockNumber_;
+        dirBlock_ = SdVolume::cacheBlockNumber();
       }
       // done if no entries follow
       if (p->name[0] == DIR_NAME_FREE) break;
@@ -419,9 +710,17 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
       if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
 
       // open found file
-      return openCachedEntry(0XF & index, oflag);
+      if (!openCachedEntry(0XF & index, oflag)) return false;
+      lookupAdd(dirFile->firstCluster_, dname);
+#if SD_DIR_INDEX_SIZE
+      dirIndexScanned(dirFile);
+#endif  // SD_DIR_INDEX_SIZE
+      return true;
     }
   }
+#if SD_DIR_INDEX_SIZE
+  if (indexed < 0) dirIndexScanned(dirFile);
+#endif  // SD_DIR_INDEX_SIZE
   // only create file if O_CREAT and O_WRITE
   if ((oflag & (O_CREAT | O_WRITE)) != (O_CREAT | O_WRITE)) return false;
 
@@ -434,10 +733,14 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
 
     // add and zero cluster for dirFile - first cluster is in cache for write
     if (!dirFile->addDirCluster()) return false;
+#if SD_DIR_INDEX_SIZE
+    // directory has grown, rebuild index when next used
+    if (indexCluster_ == dirFile->firstCluster_) indexCount_ = 0;
+#endif  // SD_DIR_INDEX_SIZE
 
     // use first entry in cluster
     dirIndex_ = 0;
-    p = SdVolume::cacheBuffer_.dir;
+    p = SdVolume::cacheBuffer()->dir;
   }
   // initialize as empty file
   memset(p, 0, sizeof(dir_t));
@@ -455,12 +758,19 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
   p->lastAccessDate = p->creationDate;
   p->lastWriteDate = p->creationDate;
   p->lastWriteTime = p->creationTime;
+#if SD_DIR_INDEX_SIZE
+  if (indexCount_ && indexCluster_ == dirFile->firstCluster_) {
+    dirIndexSet(dirBlock_, dirIndex_, dirIndexHash(dname));
+  }
+#endif  // SD_DIR_INDEX_SIZE
 
   // force write of entry to SD
   if (!SdVolume::cacheFlush()) return false;
 
   // open entry in cache
-  return openCachedEntry(dirIndex_, oflag);
+  if (!openCachedEntry(dirIndex_, oflag)) return false;
+  lookupAdd(dirFile->firstCluster_, dname);
+  return true;
 }
 //------------------------------------------------------------------------------
 /**
@@ -488,6 +798,13 @@ uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
 
   // seek to location of entry
   if (!dirFile->seekSet(32 * index)) return false;
+#if SD_EXFAT_SUPPORT
+  if (vol_->isExFat()) {
+    exFatSet_t set;
+    if (dirFile->exFatReadSet(&set) <= 0) return false;
+    return exFatOpenSet(set, oflag);
+  }
+#endif  // SD_EXFAT_SUPPORT
 
   // read entry into cache
   dir_t* p = dirFile->readDirCache();
@@ -505,7 +822,7 @@ uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
 // open a cached directory entry. Assumes vol_ is initializes
 uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // location of entry in cache
-  dir_t* p = SdVolume::cacheBuffer_.dir + dirIndex;
+  dir_t* p = SdVolume::cacheBuffer()->dir + dirIndex;
 
   // write or truncate is an error for a directory or read-only file
   if (p->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
@@ -513,7 +830,7 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   }
   // remember location of directory entry on SD
   dirIndex_ = dirIndex;
-  dirBlock_ = SdVolume::cacheBlockNumber_;
+  dirBlock_ = SdVolume::cacheBlockNumber();
 
   // copy first cluster number for directory fields
   firstCluster_ = (uint32_t)p->firstClusterHigh << 16;
@@ -531,6 +848,15 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   }
   // save open flags for read/write
   flags_ = oflag & (O_ACCMODE | O_SYNC | O_APPEND);
+#if SD_EXFAT_SUPPORT
+  exFlags_ = 0;
+#endif  // SD_EXFAT_SUPPORT
+  extentReset();
+
+  // the entry on SD is current
+  syncedSize_ = fileSize_;
+  unsyncedBytes_ = 0;
+  unsyncedBlocks_ = 0;
 
   // set to start of file
   curCluster_ = 0;
@@ -559,7 +885,8 @@ uint8_t SdFile::openRoot(SdVolume* vol) {
     type_ = FAT_FILE_TYPE_ROOT16;
     firstCluster_ = 0;
     fileSize_ = 32 * vol->rootDirEntryCount();
-  } else if (vol->fatType() == 32) {
+  } else if (vol->fatType() == 32 || vol->fatType() == 64) {
+    // FAT32 and exFAT roots are cluster chains
     type_ = FAT_FILE_TYPE_ROOT32;
     firstCluster_ = vol->rootDirStart();
     if (!vol->chainSize(firstCluster_, &fileSize_)) return false;
@@ -570,6 +897,16 @@ uint8_t SdFile::openRoot(SdVolume* vol) {
   vol_ = vol;
   // read only
   flags_ = O_READ;
+#if SD_EXFAT_SUPPORT
+  exFlags_ = 0;
+#endif  // SD_EXFAT_SUPPORT
+  extentReset();
+
+  // forget entries from a previous volume
+  for (uint8_t i = 0; i < SD_DIR_LOOKUP_COUNT; i++) lookup_[i].block = 0;
+#if SD_DIR_INDEX_SIZE
+  indexCount_ = 0;
+#endif  // SD_DIR_INDEX_SIZE
 
   // set to start of file
   curCluster_ = 0;
@@ -581,6 +918,42 @@ uint8_t SdFile::openRoot(SdVolume* vol) {
   return true;
 }
 //------------------------------------------------------------------------------
+/**
+ * Return the next byte from a file without advancing the position.
+ *
+ * \return For success peek returns the next byte in the file as an int.
+ * If an error occurs or end of file is reached -1 is returned.
+ */
+int16_t SdFile::peek(void) {
+  uint32_t i = curPosition_ - winStart_;
+  if (i < winRead_ && winSlot_->blockNumber == winBlock_) {
+    return winSlot_->buf.data[i + 1];
+  }
+  int16_t c = read();
+  if (c >= 0 && !seekCur(-1)) return -1;
+  return c;
+}
+//------------------------------------------------------------------------------
+// Return the number of blocks, from the full block about to be written at
+// curPosition_, that the card may pre-erase if a multiple block write
+// starts there.  Pre-erased blocks that are not written are left undefined
+// so the count stops at data this write does not replace and at the end of
+// the clusters known to be contiguous.
+uint32_t SdFile::preEraseCount(uint16_t blockOfCluster, uint32_t nToWrite) {
+  uint8_t shift = vol_->clusterSizeShift_;
+  uint32_t run = extentRun(curPosition_ >> (shift + 9));
+  uint32_t count = run ? (run << shift) - blockOfCluster
+                       : vol_->blocksPerCluster_ - blockOfCluster;
+
+  // a raw log has no data past the current position
+  uint32_t dataEnd = flags_ & F_FILE_RAW_LOG ? curPosition_ : fileSize_;
+  if (curPosition_ + nToWrite < dataEnd && count > (nToWrite >> 9)) {
+    // only the full blocks of this write
+    count = nToWrite >> 9;
+  }
+  return count;
+}
+//------------------------------------------------------------------------------
 /** %Print the name field of a directory entry in 8.3 format to Serial.
  *
  * \param[in] dir The directory structure containing the name.
@@ -651,6 +1024,26 @@ void SdFile::printTwoDigits(uint8_t v) {
   Serial.print(str);
 }
 //------------------------------------------------------------------------------
+/**
+ * Read the next byte from a file.
+ *
+ * Bytes after the first in a block are taken from the cached block
+ * without the checks of read(buf, nbyte), so parsing a file a byte at a
+ * time costs little more than copying it.
+ *
+ * \return For success read returns the next byte in the file as an int.
+ * If an error occurs or end of file is reached -1 is returned.
+ */
+int16_t SdFile::read(void) {
+  uint32_t i = curPosition_ - winStart_;
+  if (i < winRead_ && winSlot_->blockNumber == winBlock_) {
+    curPosition_++;
+    return winSlot_->buf.data[i + 1];
+  }
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+//------------------------------------------------------------------------------
 /**
  * Read data from a file starting at the current position.
  *
@@ -682,15 +1075,16 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
     if (type_ == FAT_FILE_TYPE_ROOT16) {
       block = vol_->rootDirStart() + (curPosition_ >> 9);
     } else {
-      uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+      uint16_t blockOfCluster = vol_->blockOfCluster(curPosition_);
       if (offset == 0 && blockOfCluster == 0) {
         // start of new cluster
         if (curPosition_ == 0) {
           // use first cluster in file
           curCluster_ = firstCluster_;
         } else {
-          // get next cluster from FAT
-          if (!vol_->fatGet(curCluster_, &curCluster_)) return -1;
+          // get next cluster from extent map or FAT
+          uint32_t index = curPosition_ >> (vol_->clusterSizeShift_ + 9);
+          if (!nextCluster(index, &curCluster_)) return -1;
         }
       }
       block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
@@ -701,16 +1095,30 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
     if (n > (512 - offset)) n = 512 - offset;
 
     // no buffering needed if n == 512 or user requests no buffering
-    if ((unbufferedRead() || n == 512) &&
-      block != SdVolume::cacheBlockNumber_) {
-      if (!vol_->readData(block, offset, n, dst)) return -1;
+    if ((unbufferedRead() || n == 512) && !SdVolume::cacheFind(block)) {
+      if (n == 512) {
+        // consecutive full blocks share one multiple block read
+        if (!vol_->streamRead(block, dst)) return -1;
+      } else {
+        if (!vol_->readData(block, offset, n, dst)) return -1;
+      }
       dst += n;
     } else {
       // read block to cache and copy data to caller
-      if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return -1;
-      uint8_t* src = SdVolume::cacheBuffer_.data + offset;
+      if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ,
+        isDir() ? SdVolume::CACHE_PRIORITY_DIR : SdVolume::CACHE_PRIORITY_DATA)) {
+        return -1;
+      }
+      uint8_t* src = SdVolume::cacheBuffer()->data + offset;
       uint8_t* end = src + n;
       while (src != end) *dst++ = *src++;
+
+      // read() takes the rest of the block from the cache
+      winSlot_ = SdVolume::cacheCurrent_;
+      winBlock_ = block;
+      winStart_ = curPosition_ - offset + 1;
+      winRead_ = fileSize_ - winStart_ < 511 ? fileSize_ - winStart_ : 511;
+      winWrite_ = 0;
     }
     curPosition_ += n;
     toRead -= n;
@@ -730,20 +1138,8 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
  * a directory file or an I/O error occurred.
  */
 int8_t SdFile::readDir(dir_t* dir) {
-  int8_t n;
-  // if not a directory file or miss-positioned return an error
-  if (!isDir() || (0X1F & curPosition_)) return -1;
-
-  while ((n = read(dir, sizeof(dir_t))) == sizeof(dir_t)) {
-    // last entry if DIR_NAME_FREE
-    if (dir->name[0] == DIR_NAME_FREE) break;
-    // skip empty entries and entry for .  and ..
-    if (dir->name[0] == DIR_NAME_DELETED || dir->name[0] == '.') continue;
-    // return if normal file or subdirectory
-    if (DIR_IS_FILE_OR_SUBDIR(dir)) return n;
-  }
-  // error, end of file, or past last entry
-  return n < 0 ? -1 : 0;
+  uint16_t index;
+  return readDirIndex(dir, &index);
 }
 //------------------------------------------------------------------------------
 // Read next directory entry into the cache
@@ -756,13 +1152,69 @@ dir_t* SdFile::readDirCache(void) {
   uint8_t i = (curPosition_ >> 5) & 0XF;
 
   // use read to locate and cache block
-  if (read() < 0) return NULL;
+  uint8_t b;
+  if (read(&b, 1) != 1) return NULL;
 
   // advance to next entry
   curPosition_ += 31;
 
   // return pointer to entry
-  return (SdVolume::cacheBuffer_.dir + i);
+  return (SdVolume::cacheBuffer()->dir + i);
+}
+//------------------------------------------------------------------------------
+/**
+ * Read the next file or subdirectory entry from a directory file and
+ * return its index for open() by index.  Free and deleted entries, long
+ * name entries, the volume label and the . and .. entries are skipped.
+ * An exFAT entry is returned in FAT format if its name is a valid 8.3 name.
+ *
+ * \param[out] dir The dir_t struct that will receive the entry.
+ *
+ * \param[out] index The index of the entry in the directory.
+ *
+ * \return For success readDirIndex() returns the number of bytes read.
+ * A value of zero will be returned if end of directory is reached.
+ * If an error occurs, readDirIndex() returns -1.
+ */
+int8_t SdFile::readDirIndex(dir_t* dir, uint16_t* index) {
+  int8_t n;
+  // if not a directory file or miss-positioned return an error
+  if (!isDir() || (0X1F & curPosition_)) return -1;
+#if SD_EXFAT_SUPPORT
+  if (vol_->isExFat()) {
+    while (curPosition_ < fileSize_) {
+      uint32_t pos = curPosition_;
+      dir_t* p = readDirCache();
+      if (p == NULL) return -1;
+      // done if past last used entry
+      if (p->name[0] == 0) break;
+      if (p->name[0] != EXFAT_TYPE_FILE) continue;
+      exFatSet_t set;
+      if (!seekSet(pos)) return -1;
+      n = exFatReadSet(&set);
+      if (n < 0) return -1;
+      if (n == 0 || set.name[0] == 0) continue;
+      exFatDir(set, dir);
+      *index = pos >> 5;
+      return sizeof(dir_t);
+    }
+    return 0;
+  }
+#endif  // SD_EXFAT_SUPPORT
+
+  while ((n = read(dir, sizeof(dir_t))) == sizeof(dir_t)) {
+    // last entry if DIR_NAME_FREE
+    if (dir->name[0] == DIR_NAME_FREE) break;
+    // skip empty entries and entry for .  and ..
+    if (dir->name[0] == DIR_NAME_DELETED || dir->name[0] == '.') continue;
+    // return if normal file or subdirectory
+    if (DIR_IS_FILE_OR_SUBDIR(dir)) {
+      *index = (curPosition_ >> 5) - 1;
+      return n;
+    }
+  }
+  // error, end of file, or past last entry
+  return n < 0 ? -1 : 0;
 }
 //------------------------------------------------------------------------------
 /**
@@ -782,6 +1234,13 @@ dir_t* SdFile::readDirCache(void) {
 uint8_t SdFile::remove(void) {
   // free any clusters - will fail if read-only or directory
   if (!truncate(0)) return false;
+#if SD_EXFAT_SUPPORT
+  if (vol_->isExFat()) {
+    if (!exFatRemove()) return false;
+    type_ = FAT_FILE_TYPE_CLOSED;
+    return SdVolume::cacheFlush();
+  }
+#endif  // SD_EXFAT_SUPPORT
 
   // cache directory entry
   dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
@@ -790,6 +1249,16 @@ uint8_t SdFile::remove(void) {
   // mark entry deleted
   d->name[0] = DIR_NAME_DELETED;
 
+  // forget remembered location of entry
+  for (uint8_t i = 0; i < SD_DIR_LOOKUP_COUNT; i++) {
+    dirLookup_t* e = &lookup_[i];
+    if (e->block == dirBlock_ && e->index == dirIndex_) e->block = 0;
+  }
+#if SD_DIR_INDEX_SIZE
+  // free entry in directory index
+  if (indexCount_) dirIndexSet(dirBlock_, dirIndex_, 0);
+#endif  // SD_DIR_INDEX_SIZE
+
   // set this SdFile closed
   type_ = FAT_FILE_TYPE_CLOSED;
 
@@ -848,11 +1317,23 @@ uint8_t SdFile::rmDir(void) {
     if (p == NULL) return false;
     // done if past last used entry
     if (p->name[0] == DIR_NAME_FREE) break;
+#if SD_EXFAT_SUPPORT
+    // error not empty, including names readDir() doesn't return
+    if (vol_->isExFat()) {
+      if (p->name[0] & EXFAT_TYPE_IN_USE) return false;
+      continue;
+    }
+#endif  // SD_EXFAT_SUPPORT
     // skip empty slot or '.' or '..'
     if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') continue;
     // error not empty
     if (DIR_IS_FILE_OR_SUBDIR(p)) return false;
   }
+#if SD_DIR_INDEX_SIZE
+  // drop index of removed directory
+  if (indexCluster_ == firstCluster_) indexCount_ = 0;
+#endif  // SD_DIR_INDEX_SIZE
+
   // convert empty directory to normal file for remove
   type_ = FAT_FILE_TYPE_NORMAL;
   flags_ |= O_WRITE;
@@ -875,24 +1356,16 @@ uint8_t SdFile::rmDir(void) {
  * the value zero, false, is returned for failure.
  */
 uint8_t SdFile::rmRfStar(void) {
+  dir_t d;
+  uint16_t index;
+  int8_t n;
+
   rewind();
-  while (curPosition_ < fileSize_) {
+  while ((n = readDirIndex(&d, &index)) > 0) {
     SdFile f;
 
-    // remember position
-    uint16_t index = curPosition_/32;
-
-    dir_t* p = readDirCache();
-    if (!p) return false;
-
-    // done if past last entry
-    if (p->name[0] == DIR_NAME_FREE) break;
-
-    // skip empty slot or '.' or '..'
-    if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') continue;
-
-    // skip if part of long file name or volume label in root
-    if (!DIR_IS_FILE_OR_SUBDIR(p)) continue;
+    // remember position of next entry
+    uint32_t pos = curPosition_;
 
     if (!f.open(this, index, O_READ)) return false;
     if (f.isSubDir()) {
@@ -904,10 +1377,12 @@ uint8_t SdFile::rmRfStar(void) {
       if (!f.remove()) return false;
     }
     // position to next entry if required
-    if (curPosition_ != (32*(index + 1))) {
-      if (!seekSet(32*(index + 1))) return false;
+    if (curPosition_ != pos) {
+      if (!seekSet(pos)) return false;
     }
   }
+  if (n < 0) return false;
+
   // don't try to delete root
   if (isRoot()) return true;
   return rmDir();
@@ -925,6 +1400,9 @@ uint8_t SdFile::seekSet(uint32_t pos) {
   // error if file not open or seek past end of file
   if (!isOpen() || pos > fileSize_) return false;
 
+  // the next write takes the full path to update syncedSize_
+  winWrite_ = 0;
+
   if (type_ == FAT_FILE_TYPE_ROOT16) {
     curPosition_ = pos;
     return true;
@@ -939,15 +1417,23 @@ uint8_t SdFile::seekSet(uint32_t pos) {
   uint32_t nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
   uint32_t nNew = (pos - 1) >> (vol_->clusterSizeShift_ + 9);
 
-  if (nNew < nCur || curPosition_ == 0) {
-    // must follow chain from first cluster
-    curCluster_ = firstCluster_;
+  if (nNew < extMapped_) {
+    // cluster is in the extent map
+    curCluster_ = extentCluster(nNew);
   } else {
-    // advance from curPosition
-    nNew -= nCur;
-  }
-  while (nNew--) {
-    if (!vol_->fatGet(curCluster_, &curCluster_)) return false;
+    if (nNew < nCur || curPosition_ == 0) {
+      // must follow chain from first cluster
+      nCur = 0;
+      curCluster_ = firstCluster_;
+    }
+    // start at end of extent map if it is closer
+    if (extMapped_ > nCur + 1) {
+      nCur = extMapped_ - 1;
+      curCluster_ = extentCluster(nCur);
+    }
+    while (nCur < nNew) {
+      if (!nextCluster(++nCur, &curCluster_)) return false;
+    }
   }
   curPosition_ = pos;
   return true;
@@ -966,6 +1452,11 @@ uint8_t SdFile::sync(void) {
   // only allow open files and directories
   if (!isOpen()) return false;
 
+#if SD_EXFAT_SUPPORT
+  if ((flags_ & F_FILE_DIR_DIRTY) && vol_->isExFat()) {
+    if (!exFatSync()) return false;
+  }
+#endif  // SD_EXFAT_SUPPORT
   if (flags_ & F_FILE_DIR_DIRTY) {
     dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
     if (!d) return false;
@@ -985,7 +1476,35 @@ uint8_t SdFile::sync(void) {
     // clear directory dirty
     flags_ &= ~F_FILE_DIR_DIRTY;
   }
-  return SdVolume::cacheFlush();
+  if (!SdVolume::fatMirrorFlush()) return false;
+
+  // end any streamed transfer so all data blocks are programmed
+  if (!SdVolume::streamStop()) return false;
+
+  // a raw log entry keeps the preallocated size, data ends at the position
+  syncedSize_ = (flags_ & F_FILE_RAW_LOG) ? curPosition_ : fileSize_;
+  unsyncedBytes_ = 0;
+  unsyncedBlocks_ = 0;
+  winWrite_ = 0;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Call sync() if a write-behind limit has been reached.  See
+ * setWriteBehind().
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdFile::syncBehind(void) {
+  if (!unsyncedBytes_) return true;
+  if ((behindBytes_ && unsyncedBytes_ >= behindBytes_)
+    || (behindBlocks_ && unsyncedBlocks_ >= behindBlocks_)
+    || (behindMillis_
+      && (uint16_t)((uint16_t)millis() - unsyncedTime_) >= behindMillis_)) {
+    return sync();
+  }
+  return true;
 }
 //------------------------------------------------------------------------------
 /**
@@ -1036,11 +1555,27 @@ uint8_t SdFile::timestamp(uint8_t flags, uint16_t year, uint8_t month,
     || second > 59) {
       return false;
   }
+  uint16_t dirDate = FAT_DATE(year, month, day);
+  uint16_t dirTime = FAT_TIME(hour, minute, second);
+#if SD_EXFAT_SUPPORT
+  if (vol_->isExFat()) {
+    exFile_t* f = reinterpret_cast<exFile_t*>(
+                    exFatEntry(0, SdVolume::CACHE_FOR_WRITE));
+    if (!f) return false;
+    uint32_t stamp = (uint32_t)dirDate << 16 | dirTime;
+    if (flags & T_ACCESS) f->accessTimestamp = stamp;
+    if (flags & T_CREATE) {
+      f->createTimestamp = stamp;
+      f->create10ms = second & 1 ? 100 : 0;
+    }
+    if (flags & T_WRITE) f->modifyTimestamp = stamp;
+    if (!exFatChecksum()) return false;
+    return sync();
+  }
+#endif  // SD_EXFAT_SUPPORT
   dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
   if (!d) return false;
 
-  uint16_t dirDate = FAT_DATE(year, month, day);
-  uint16_t dirTime = FAT_TIME(hour, minute, second);
   if (flags & T_ACCESS) {
     d->lastAccessDate = dirDate;
   }
@@ -1080,13 +1615,27 @@ uint8_t SdFile::truncate(uint32_t length) {
   // fileSize and length are zero - nothing to do
   if (fileSize_ == 0) return true;
 
+  // the window may hold clusters about to be freed
+  winRead_ = winWrite_ = 0;
+
   // remember position for seek after truncation
   uint32_t newPos = curPosition_ > length ? length : curPosition_;
 
   // position to last cluster in truncated file
   if (!seekSet(length)) return false;
 
+#if SD_EXFAT_SUPPORT
+  if (exFlags_ & EXFAT_FLAG_NO_FAT_CHAIN) {
+    // a contiguous exFAT file has no chain, free clusters past curCluster_
+    uint32_t keep = length ? curCluster_ + 1 - firstCluster_ : 0;
+    if (!vol_->freeRange(firstCluster_ + keep, extMapped_ - keep)) {
+      return false;
+    }
+    if (keep == 0) firstCluster_ = 0;
+  } else if (length == 0) {
+#else  // SD_EXFAT_SUPPORT
   if (length == 0) {
+#endif  // SD_EXFAT_SUPPORT
     // free all clusters
     if (!vol_->freeChain(firstCluster_)) return false;
     firstCluster_ = 0;
@@ -1103,6 +1652,13 @@ uint8_t SdFile::truncate(uint32_t length) {
     }
   }
   fileSize_ = length;
+#if SD_EXFAT_SUPPORT
+  // an empty exFAT file is contiguous until it isn't
+  if (vol_->isExFat() && length == 0) exFlags_ |= EXFAT_FLAG_NO_FAT_CHAIN;
+#endif  // SD_EXFAT_SUPPORT
+
+  // chain has changed
+  extentReset();
 
   // need to update directory entry
   flags_ |= F_FILE_DIR_DIRTY;
@@ -1113,6 +1669,21 @@ uint8_t SdFile::truncate(uint32_t length) {
   return seekSet(newPos);
 }
 //------------------------------------------------------------------------------
+// store b in the cached block if the write window covers the position
+uint8_t SdFile::winPut(uint8_t b) {
+  uint32_t i = curPosition_ - winStart_;
+  if (i >= winWrite_ || winSlot_->blockNumber != winBlock_) return false;
+  winSlot_->buf.data[i + 1] = b;
+  winSlot_->dirty = SdVolume::CACHE_FOR_WRITE;
+  if (++curPosition_ > fileSize_) {
+    // insure sync will update dir entry
+    fileSize_ = curPosition_;
+    flags_ |= F_FILE_DIR_DIRTY;
+  }
+  unsyncedBytes_++;
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Write data to an open file.
  *
@@ -1147,9 +1718,16 @@ int16_t SdFile::write(const void* buf, uint16_t nbyte) {
   if ((flags_ & O_APPEND) && curPosition_ != fileSize_) {
     if (!seekEnd()) goto writeErrorReturn;
   }
+  // raw log can't grow past preallocated size
+  if ((flags_ & F_FILE_RAW_LOG) && nbyte > (fileSize_ - curPosition_)) {
+    goto writeErrorReturn;
+  }
+  // data from here on is no longer durable
+  if (curPosition_ < syncedSize_) syncedSize_ = curPosition_;
+  if (!unsyncedBytes_) unsyncedTime_ = millis();
 
   while (nToWrite > 0) {
-    uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+    uint16_t blockOfCluster = vol_->blockOfCluster(curPosition_);
     uint16_t blockOffset = curPosition_ & 0X1FF;
     if (blockOfCluster == 0 && blockOffset == 0) {
       // start of new cluster
@@ -1161,8 +1739,9 @@ int16_t SdFile::write(const void* buf, uint16_t nbyte) {
           curCluster_ = firstCluster_;
         }
       } else {
-        uint32_t next;
-        if (!vol_->fatGet(curCluster_, &next)) return false;
+        uint32_t next = curCluster_;
+        uint32_t index = curPosition_ >> (vol_->clusterSizeShift_ + 9);
+        if (!nextCluster(index, &next)) return false;
         if (vol_->isEOC(next)) {
           // add cluster if at end of chain
           if (!addCluster()) goto writeErrorReturn;
@@ -1182,27 +1761,35 @@ int16_t SdFile::write(const void* buf, uint16_t nbyte) {
     if (n == 512) {
       // full block - don't need to use cache
       // invalidate cache if block is in cache
-      if (SdVolume::cacheBlockNumber_ == block) {
-        SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-      }
-      if (!vol_->writeBlock(block, src)) goto writeErrorReturn;
+      SdVolume::cacheInvalidate(block);
+      // consecutive full blocks share one multiple block write
+      uint32_t eraseCount = preEraseCount(blockOfCluster, nToWrite);
+      if (!vol_->streamWrite(block, src, eraseCount)) goto writeErrorReturn;
       src += 512;
     } else {
-      if (blockOffset == 0 && curPosition_ >= fileSize_) {
+      if (blockOffset == 0
+        && (curPosition_ >= fileSize_ || (flags_ & F_FILE_RAW_LOG))) {
         // start of new block don't need to read into cache
-        if (!SdVolume::cacheFlush()) goto writeErrorReturn;
-        SdVolume::cacheBlockNumber_ = block;
-        SdVolume::cacheSetDirty();
+        if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_RESERVE_FOR_WRITE)) {
+          goto writeErrorReturn;
+        }
       } else {
         // rewrite part of block
         if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) {
           goto writeErrorReturn;
         }
       }
-      uint8_t* dst = SdVolume::cacheBuffer_.data + blockOffset;
+      uint8_t* dst = SdVolume::cacheBuffer()->data + blockOffset;
       uint8_t* end = dst + n;
       while (dst != end) *dst++ = *src++;
+
+      // window for write(b), set below once the write is accounted for
+      winSlot_ = SdVolume::cacheCurrent_;
+      winBlock_ = block;
+      winStart_ = curPosition_ - blockOffset + 1;
+      winRead_ = winWrite_ = 0;
     }
+    if (blockOffset + n == 512) unsyncedBlocks_++;
     nToWrite -= n;
     curPosition_ += n;
   }
@@ -1210,13 +1797,27 @@ int16_t SdFile::write(const void* buf, uint16_t nbyte) {
     // update fileSize and insure sync will update dir entry
     fileSize_ = curPosition_;
     flags_ |= F_FILE_DIR_DIRTY;
-  } else if (dateTime_ && nbyte) {
+  } else if (dateTime_ && nbyte && !(flags_ & F_FILE_RAW_LOG)) {
     // insure sync will update modified date and time
     flags_ |= F_FILE_DIR_DIRTY;
   }
 
+  unsyncedBytes_ += nbyte;
   if (flags_ & O_SYNC) {
     if (!sync()) goto writeErrorReturn;
+  } else if (!syncBehind()) {
+    goto writeErrorReturn;
+  }
+  if (unsyncedBytes_ && !(flags_ & O_APPEND)) {
+    // write(b) may replace the rest of the block but not the last byte,
+    // that completes the block, or a byte that reaches a write-behind limit
+    uint32_t end = winStart_ + 510;
+    if ((flags_ & F_FILE_RAW_LOG) && end > fileSize_) end = fileSize_;
+    if (behindBytes_) {
+      uint32_t limit = curPosition_ + behindBytes_ - unsyncedBytes_ - 1;
+      if (end > limit) end = limit;
+    }
+    winWrite_ = end > winStart_ ? end - winStart_ : 0;
   }
   return nbyte;
 
@@ -1233,11 +1834,11 @@ int16_t SdFile::write(const void* buf, uint16_t nbyte) {
  */
 #if ARDUINO >= 100
 size_t SdFile::write(uint8_t b) {
-  return write(&b, 1);
+  return winPut(b) ? 1 : write(&b, 1);
 }
 #else
 void SdFile::write(uint8_t b) {
-  write(&b, 1);
+  if (!winPut(b)) write(&b, 1);
 }
 #endif
 //------------------------------------------------------------------------------
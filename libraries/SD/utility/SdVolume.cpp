@@ -19,16 +19,17 @@
  */
 #include <SdFat.h>
 //------------------------------------------------------------------------------
-// raw block cache
-// init cacheBlockNumber_to invalid SD block number
-uint32_t SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-cache_t  SdVolume::cacheBuffer_;     // 512 byte cache for Sd2Card
-Sd2Card* SdVolume::sdCard_;          // pointer to SD card object
-uint8_t  SdVolume::cacheDirty_ = 0;  // cacheFlush() will write block if true
-uint32_t SdVolume::cacheMirrorBlock_ = 0;  // mirror  block for second FAT
+// raw block cache - slots are set empty by init()
+cacheSlot_t  SdVolume::cacheSlot_[SD_CACHE_SLOT_COUNT];
+cacheSlot_t* SdVolume::cacheCurrent_ = SdVolume::cacheSlot_;
+Sd2Card*     SdVolume::sdCard_;      // pointer to SD card object
+uint8_t      SdVolume::fatMirror_ = FAT_MIRROR_WRITE;
+uint32_t     SdVolume::mirrorPending_[SD_FAT_MIRROR_PENDING];
+uint32_t     SdVolume::mirrorOffset_;
 //------------------------------------------------------------------------------
-// find a contiguous group of clusters
-uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
+// find a contiguous group of clusters, link them in the FAT if fatChain
+uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster,
+                                  uint8_t fatChain) {
   // start of group
   uint32_t bgnCluster;
 
@@ -52,9 +53,15 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // end of group
   uint32_t endCluster = bgnCluster;
 
+  // start of the current run of clusters in use
+  uint32_t usedCluster = bgnCluster;
+
   // last cluster of FAT
   uint32_t fatEnd = clusterCount_ + 1;
 
+  // mask for first cluster of a free map group
+  uint32_t groupMask = (1UL << freeMapShift_) - 1;
+
   // search the FAT for free clusters
   for (uint32_t n = 0;; n++, endCluster++) {
     // can't find space checked all clusters
@@ -62,30 +69,64 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
 
     // past end - start from beginning of FAT
     if (endCluster > fatEnd) {
-      bgnCluster = endCluster = 2;
+      bgnCluster = endCluster = usedCluster = 2;
+    }
+    // skip groups known to have no free clusters
+    if (freeMapFull(endCluster)) {
+      uint32_t next = (endCluster | groupMask) + 1;
+      n += next - endCluster - 1;
+      endCluster = next - 1;
+      bgnCluster = next;
+      continue;
     }
     uint32_t f;
+#if SD_EXFAT_SUPPORT
+    if (fatType_ == 64 ? !bitmapGet(endCluster, &f) : !fatGet(endCluster, &f)) {
+      return false;
+    }
+#else  // SD_EXFAT_SUPPORT
     if (!fatGet(endCluster, &f)) return false;
+#endif  // SD_EXFAT_SUPPORT
 
     if (f != 0) {
       // cluster in use try next cluster as bgnCluster
       bgnCluster = endCluster + 1;
-    } else if ((endCluster - bgnCluster + 1) == count) {
+
+      // remember if whole group has been checked and is full
+      if ((endCluster & groupMask) == groupMask || endCluster == fatEnd) {
+        uint32_t groupStart = endCluster & ~groupMask;
+        if (usedCluster <= (groupStart < 2 ? 2 : groupStart)) {
+          freeMapSet(endCluster, true);
+        }
+      }
+    } else {
+      // free cluster ends run of clusters in use
+      usedCluster = endCluster + 1;
+
       // done - found space
-      break;
+      if ((endCluster - bgnCluster + 1) == count) break;
     }
   }
-  // mark end of chain
-  if (!fatPutEOC(endCluster)) return false;
-
-  // link clusters
-  while (endCluster > bgnCluster) {
-    if (!fatPut(endCluster - 1, endCluster)) return false;
-    endCluster--;
+#if SD_EXFAT_SUPPORT
+  // exFAT allocation is in the bitmap, the FAT only links the clusters
+  if (fatType_ == 64
+    && !bitmapPut(bgnCluster, endCluster - bgnCluster + 1, true)) {
+    return false;
   }
-  if (*curCluster != 0) {
-    // connect chains
-    if (!fatPut(*curCluster, bgnCluster)) return false;
+#endif  // SD_EXFAT_SUPPORT
+  if (fatChain) {
+    // mark end of chain
+    if (!fatPutEOC(endCluster)) return false;
+
+    // link clusters
+    while (endCluster > bgnCluster) {
+      if (!fatPut(endCluster - 1, endCluster)) return false;
+      endCluster--;
+    }
+    if (*curCluster != 0) {
+      // connect chains
+      if (!fatPut(*curCluster, bgnCluster)) return false;
+    }
   }
   // return first cluster number to caller
   *curCluster = bgnCluster;
@@ -96,43 +137,99 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   return true;
 }
 //------------------------------------------------------------------------------
+// return the slot that holds blockNumber or NULL if it is not cached
+cacheSlot_t* SdVolume::cacheFind(uint32_t blockNumber) {
+  for (uint8_t i = 0; i < SD_CACHE_SLOT_COUNT; i++) {
+    if (cacheSlot_[i].blockNumber == blockNumber) return &cacheSlot_[i];
+  }
+  return NULL;
+}
+//------------------------------------------------------------------------------
+// write all dirty cache slots
 uint8_t SdVolume::cacheFlush(void) {
-  if (cacheDirty_) {
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
+  for (uint8_t i = 0; i < SD_CACHE_SLOT_COUNT; i++) {
+    if (!cacheFlushSlot(&cacheSlot_[i])) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::cacheFlushSlot(cacheSlot_t* slot) {
+  if (slot->dirty) {
+    if (!sdCard_->writeBlock(slot->blockNumber, slot->buf.data)) {
       return false;
     }
-    // mirror FAT tables
-    if (cacheMirrorBlock_) {
-      if (!sdCard_->writeBlock(cacheMirrorBlock_, cacheBuffer_.data)) {
-        return false;
+    // mirror FAT tables now unless the copy can wait for fatMirrorFlush()
+    if (slot->mirrorBlock) {
+      if (fatMirror_ == FAT_MIRROR_WRITE || !mirrorDefer(slot->blockNumber)) {
+        if (!sdCard_->writeBlock(slot->mirrorBlock, slot->buf.data)) {
+          return false;
+        }
       }
-      cacheMirrorBlock_ = 0;
+      slot->mirrorBlock = 0;
     }
-    cacheDirty_ = 0;
+    slot->dirty = 0;
   }
   return true;
 }
 //------------------------------------------------------------------------------
-uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
-  if (cacheBlockNumber_ != blockNumber) {
-    if (!cacheFlush()) return false;
-    if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) return false;
-    cacheBlockNumber_ = blockNumber;
+// drop a block that is about to be written directly to the device
+void SdVolume::cacheInvalidate(uint32_t blockNumber) {
+  cacheSlot_t* slot = cacheFind(blockNumber);
+  if (slot) {
+    slot->blockNumber = 0XFFFFFFFF;
+    slot->mirrorBlock = 0;
+    slot->dirty = 0;
   }
-  cacheDirty_ |= action;
+}
+//------------------------------------------------------------------------------
+/**
+ * Make blockNumber the current cache block.  The block is read unless
+ * action has CACHE_OPTION_NO_READ set.  If the block is not cached an
+ * empty slot is used, otherwise the least recently used slot with the
+ * lowest priority is flushed and replaced.
+ */
+uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action,
+                                uint8_t priority) {
+  cacheSlot_t* slot = cacheFind(blockNumber);
+  if (!slot) {
+    // select a slot to replace
+    slot = cacheSlot_;
+    for (uint8_t i = 1; i < SD_CACHE_SLOT_COUNT; i++) {
+      cacheSlot_t* s = &cacheSlot_[i];
+      if (slot->blockNumber == 0XFFFFFFFF) break;
+      if (s->blockNumber == 0XFFFFFFFF
+        || s->priority < slot->priority
+        || (s->priority == slot->priority && s->age > slot->age)) {
+        slot = s;
+      }
+    }
+    if (!cacheFlushSlot(slot)) return false;
+    slot->blockNumber = 0XFFFFFFFF;
+    if (!(action & CACHE_OPTION_NO_READ)) {
+      if (!sdCard_->readBlock(blockNumber, slot->buf.data)) return false;
+    }
+    slot->blockNumber = blockNumber;
+  }
+  // move slot to front of least recently used order
+  for (uint8_t i = 0; i < SD_CACHE_SLOT_COUNT; i++) {
+    if (cacheSlot_[i].age < slot->age) cacheSlot_[i].age++;
+  }
+  slot->age = 0;
+  slot->priority = priority;
+  slot->dirty |= action & CACHE_FOR_WRITE;
+  cacheCurrent_ = slot;
   return true;
 }
 //------------------------------------------------------------------------------
 // cache a zero block for blockNumber
 uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
-  if (!cacheFlush()) return false;
+  if (!cacheRawBlock(blockNumber, CACHE_RESERVE_FOR_WRITE,
+                     CACHE_PRIORITY_DIR)) return false;
 
-  // loop take less flash than memset(cacheBuffer_.data, 0, 512);
+  // loop take less flash than memset(cacheCurrent_->buf.data, 0, 512);
   for (uint16_t i = 0; i < 512; i++) {
-    cacheBuffer_.data[i] = 0;
+    cacheCurrent_->buf.data[i] = 0;
   }
-  cacheBlockNumber_ = blockNumber;
-  cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
@@ -152,17 +249,74 @@ uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) const {
   if (cluster > (clusterCount_ + 1)) return false;
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
+  if (lba != cacheCurrent_->blockNumber) {
+    if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_PRIORITY_FAT)) return false;
   }
   if (fatType_ == 16) {
-    *value = cacheBuffer_.fat16[cluster & 0XFF];
+    *value = cacheCurrent_->buf.fat16[cluster & 0XFF];
+  } else if (fatType_ == 32) {
+    *value = cacheCurrent_->buf.fat32[cluster & 0X7F] & FAT32MASK;
   } else {
-    *value = cacheBuffer_.fat32[cluster & 0X7F] & FAT32MASK;
+    // exFAT entries are 32 bits
+    *value = cacheCurrent_->buf.fat32[cluster & 0X7F];
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Write the second FAT copy of blocks deferred by FAT_MIRROR_DEFER.  Dirty
+ * cache blocks are written first.  Called by SdFile::sync().
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdVolume::fatMirrorFlush(void) {
+  if (!cacheFlush()) return false;
+  for (uint8_t i = 0; i < SD_FAT_MIRROR_PENDING; i++) {
+    uint32_t lba = mirrorPending_[i];
+    if (!lba) continue;
+    if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_PRIORITY_FAT)) return false;
+    if (!sdCard_->writeBlock(lba + mirrorOffset_, cacheCurrent_->buf.data)) {
+      return false;
+    }
+    mirrorPending_[i] = 0;
   }
   return true;
 }
 //------------------------------------------------------------------------------
+/**
+ * Count free clusters in the volume.  The FAT is read once, later changes
+ * are tracked by fatPut().  The scan also completes the free cluster summary
+ * used by allocContiguous().
+ *
+ * \return The number of free clusters or -1 if an error occurs.
+ */
+int32_t SdVolume::freeClusterCount(void) {
+  if (freeClusterCount_ >= 0) return freeClusterCount_;
+#if SD_EXFAT_SUPPORT
+  if (fatType_ == 64) return bitmapFreeCount();
+#endif  // SD_EXFAT_SUPPORT
+
+  uint32_t groupMask = (1UL << freeMapShift_) - 1;
+  uint32_t fatEnd = clusterCount_ + 1;
+  int32_t free = 0;
+  uint8_t groupFull = true;
+  for (uint32_t cluster = 2; cluster <= fatEnd; cluster++) {
+    uint32_t f;
+    if (!fatGet(cluster, &f)) return -1;
+    if (f == 0) {
+      free++;
+      groupFull = false;
+    }
+    if ((cluster & groupMask) == groupMask || cluster == fatEnd) {
+      freeMapSet(cluster, groupFull);
+      groupFull = true;
+    }
+  }
+  freeClusterCount_ = free;
+  return free;
+}
+//------------------------------------------------------------------------------
 // Store a FAT entry
 uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   // error if reserved cluster
@@ -175,19 +329,33 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
 
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
+  if (lba != cacheCurrent_->blockNumber) {
+    if (!cacheRawBlock(lba, CACHE_FOR_READ, CACHE_PRIORITY_FAT)) return false;
   }
   // store entry
+  uint32_t old;
   if (fatType_ == 16) {
-    cacheBuffer_.fat16[cluster & 0XFF] = value;
+    old = cacheCurrent_->buf.fat16[cluster & 0XFF];
+    cacheCurrent_->buf.fat16[cluster & 0XFF] = value;
   } else {
-    cacheBuffer_.fat32[cluster & 0X7F] = value;
+    old = cacheCurrent_->buf.fat32[cluster & 0X7F] & FAT32MASK;
+    cacheCurrent_->buf.fat32[cluster & 0X7F] = value;
   }
   cacheSetDirty();
 
+  // exFAT has one FAT and keeps the free count in the bitmap
+  if (fatType_ == 64) return true;
+
+  // maintain free cluster count and summary
+  if (value == 0) {
+    freeMapSet(cluster, false);
+    if (old != 0 && freeClusterCount_ >= 0) freeClusterCount_++;
+  } else if (old == 0 && freeClusterCount_ >= 0) {
+    freeClusterCount_--;
+  }
+
   // mirror second FAT
-  if (fatCount_ > 1) cacheMirrorBlock_ = lba + blocksPerFat_;
+  if (fatCount_ > 1) cacheCurrent_->mirrorBlock = lba + blocksPerFat_;
   return true;
 }
 //------------------------------------------------------------------------------
@@ -201,14 +369,32 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
     if (!fatGet(cluster, &next)) return false;
 
     // free cluster
+#if SD_EXFAT_SUPPORT
+    if (fatType_ == 64 ? !bitmapPut(cluster, 1, false) : !fatPut(cluster, 0)) {
+      return false;
+    }
+#else  // SD_EXFAT_SUPPORT
     if (!fatPut(cluster, 0)) return false;
-
+#endif  // SD_EXFAT_SUPPORT
     cluster = next;
   } while (!isEOC(cluster));
 
   return true;
 }
 //------------------------------------------------------------------------------
+// remember a FAT block whose second copy is stale, false if there is no room
+uint8_t SdVolume::mirrorDefer(uint32_t blockNumber) {
+  if (fatMirror_ == FAT_MIRROR_OFF) return true;
+  uint32_t* pending = NULL;
+  for (uint8_t i = 0; i < SD_FAT_MIRROR_PENDING; i++) {
+    if (mirrorPending_[i] == blockNumber) return true;
+    if (!mirrorPending_[i]) pending = &mirrorPending_[i];
+  }
+  if (!pending) return false;
+  *pending = blockNumber;
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Initialize a FAT volume.
  *
@@ -227,12 +413,20 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
 uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
   uint32_t volumeStartBlock = 0;
   sdCard_ = dev;
+
+  // start with all cache slots empty
+  for (uint8_t i = 0; i < SD_CACHE_SLOT_COUNT; i++) {
+    cacheSlot_[i].blockNumber = 0XFFFFFFFF;
+    cacheSlot_[i].mirrorBlock = 0;
+    cacheSlot_[i].dirty = 0;
+    cacheSlot_[i].age = i;
+  }
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
   if (part) {
     if (part > 4)return false;
     if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-    part_t* p = &cacheBuffer_.mbr.part[part-1];
+    part_t* p = &cacheCurrent_->buf.mbr.part[part-1];
     if ((p->boot & 0X7F) !=0  ||
       p->totalSectors < 100 ||
       p->firstSector == 0) {
@@ -242,7 +436,12 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     volumeStartBlock = p->firstSector;
   }
   if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-  bpb_t* bpb = &cacheBuffer_.fbs.bpb;
+#if SD_EXFAT_SUPPORT
+  if (!memcmp(cacheCurrent_->buf.exfbs.fileSystemName, "EXFAT   ", 8)) {
+    return exFatInit(volumeStartBlock);
+  }
+#endif  // SD_EXFAT_SUPPORT
+  bpb_t* bpb = &cacheCurrent_->buf.fbs.bpb;
   if (bpb->bytesPerSector != 512 ||
     bpb->fatCount == 0 ||
     bpb->reservedSectorCount == 0 ||
@@ -262,6 +461,10 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
   blocksPerFat_ = bpb->sectorsPerFat16 ?
                     bpb->sectorsPerFat16 : bpb->sectorsPerFat32;
 
+  // no second FAT blocks are waiting
+  mirrorOffset_ = blocksPerFat_;
+  for (uint8_t i = 0; i < SD_FAT_MIRROR_PENDING; i++) mirrorPending_[i] = 0;
+
   fatStartBlock_ = volumeStartBlock + bpb->reservedSectorCount;
 
   // count for FAT16 zero for FAT32
@@ -291,5 +494,33 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     rootDirStart_ = bpb->fat32RootCluster;
     fatType_ = 32;
   }
+  // free count is unknown and all groups may have free clusters
+  freeClusterCount_ = -1;
+  for (uint8_t i = 0; i < SD_FREE_MAP_SIZE; i++) freeMap_[i] = 0;
+
+  // smallest group of whole FAT blocks that fits the summary
+  freeMapShift_ = fatType_ == 16 ? 8 : 7;
+  while (((clusterCount_ + 1) >> freeMapShift_) >= 8 * SD_FREE_MAP_SIZE) {
+    freeMapShift_++;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Select when the second FAT is written.  Blocks waiting for the second
+ * FAT are written before the mode changes.
+ *
+ * \param[in] mode FAT_MIRROR_WRITE to write both copies of each FAT block
+ * together, FAT_MIRROR_DEFER to write the second copy when a file is
+ * synced or closed, or FAT_MIRROR_OFF to never write it.  With
+ * FAT_MIRROR_OFF the second FAT goes stale and disk checkers will report
+ * the FATs differ, use it only for volumes that are reformatted.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdVolume::setFatMirror(uint8_t mode) {
+  if (mode > FAT_MIRROR_OFF || !fatMirrorFlush()) return false;
+  fatMirror_ = mode;
   return true;
 }
@@ -22,7 +22,7 @@ static uint8_t usb_error = 0;
 static uint8_t usb_task_state;
 
 /* constructor */
-USB::USB() : bmHubPre(0) {
+USB::USB() : bmHubPre(0), idleHandler(NULL), xferQueue(NULL), pollList(NULL) {
         usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE; //set up state machine
         init();
 }
@@ -31,6 +31,12 @@ USB::USB() : bmHubPre(0) {
 void USB::init() {
         //devConfigIndex = 0;
         bmHubPre = 0;
+        /* the bus is gone, drop the asynchronous transfers without calling back */
+        while(xferQueue) {
+                xferQueue->flags &= ~bmUSB_XFER_PENDING;
+                xferQueue = xferQueue->next;
+        }
+        pollList = NULL;
 }
 
 uint8_t USB::getUsbTaskState(void) {
@@ -221,6 +227,7 @@ uint8_t USB::inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t*
 uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t* data) {
         uint8_t rcode = 0;
         uint8_t pktsize;
+        uint8_t hirq;
 
         uint16_t nbytes = *nbytesptr;
         //printf("Requesting %i bytes ", nbytes);
@@ -242,14 +249,14 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
                         //printf(">>>>>>>> Problem! dispatchPkt %2.2x\r\n", rcode);
                         break; //should be 0, indicating ACK. Else return error code.
                 }
+                pktsize = regRdIrq(rRCVBC, &hirq); //number of received bytes, HIRQ comes with it
                 /* check for RCVDAVIRQ and generate error if not present */
                 /* the only case when absence of RCVDAVIRQ makes sense is when toggle error occurred. Need to add handling for that */
-                if((regRd(rHIRQ) & bmRCVDAVIRQ) == 0) {
+                if((hirq & bmRCVDAVIRQ) == 0) {
                         //printf(">>>>>>>> Problem! NO RCVDAVIRQ!\r\n");
                         rcode = 0xf0; //receive error
                         break;
                 }
-                pktsize = regRd(rRCVBC); //number of received bytes
                 //printf("Got %i bytes \r\n", pktsize);
                 // This would be OK, but...
                 //assert(pktsize <= nbytes);
@@ -265,9 +272,8 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
                 if(mem_left < 0)
                         mem_left = 0;
 
-                data = bytesRd(rRCVFIFO, ((pktsize > mem_left) ? mem_left : pktsize), data);
+                data = rcvFifoRd(((pktsize > mem_left) ? mem_left : pktsize), data); // read and free the buffer
 
-                regWr(rHIRQ, bmRCVDAVIRQ); // Clear the IRQ & free the buffer
                 *nbytesptr += pktsize; // add this packet's byte count to total transfer length
 
                 /* The transfer is complete under two conditions:           */
@@ -286,7 +292,8 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
 }
 
 /* OUT transfer to arbitrary endpoint. Handles multiple packets if necessary. Transfers 'nbytes' bytes. */
-/* Handles NAK bug per Maxim Application Note 4000 for single buffer transfer   */
+/* Loads the next packet into the second SNDFIFO buffer while the current one is on the wire. */
+/* Handles NAK bug per Maxim Application Note 4000                              */
 
 /* rcode 0 if no errors. rcode 01-0f is relayed from HRSL                       */
 uint8_t USB::outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data) {
@@ -302,10 +309,11 @@ uint8_t USB::outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* dat
 }
 
 uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8_t *data) {
-        uint8_t rcode = hrSUCCESS, retry_count;
+        uint8_t rcode = hrSUCCESS, retry_count, hrsl;
         uint8_t *data_p = data; //local copy of the data pointer
-        uint16_t bytes_tosend, nak_count;
+        uint16_t bytes_tosend, bytes_next, nak_count;
         uint16_t bytes_left = nbytes;
+        bool preload = true, preloaded = false;
 
         uint8_t maxpktsize = pep->maxPktSize;
 
@@ -316,16 +324,28 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
 
         regWr(rHCTL, (pep->bmSndToggle) ? bmSNDTOG1 : bmSNDTOG0); //set toggle value
 
+        bytes_tosend = (bytes_left >= maxpktsize) ? maxpktsize : bytes_left;
+        bytesWr(rSNDFIFO, bytes_tosend, data_p); //filling output FIFO
+
         while(bytes_left) {
                 retry_count = 0;
                 nak_count = 0;
-                bytes_tosend = (bytes_left >= maxpktsize) ? maxpktsize : bytes_left;
-                bytesWr(rSNDFIFO, bytes_tosend, data_p); //filling output FIFO
-                regWr(rSNDBC, bytes_tosend); //set number of bytes
+                regWr(rSNDBC, bytes_tosend); //set number of bytes, hands the buffer to the SIE
                 regWr(rHXFR, (tokOUT | pep->epAddr)); //dispatch packet
-                while(!(regRd(rHIRQ) & bmHXFRDNIRQ)); //wait for the completion IRQ
-                regWr(rHIRQ, bmHXFRDNIRQ); //clear IRQ
-                rcode = (regRd(rHRSL) & 0x0f);
+                /* Fill the other SNDFIFO buffer while this packet is on the wire. It is only committed */
+                /* once the current packet is acknowledged, so a NAK never finds two buffers queued.     */
+                /* While 'preloaded' is set those bytes sit uncommitted in the FIFO; every exit must    */
+                /* drop them, or the next transfer would append to them.                                */
+                bytes_next = bytes_left - bytes_tosend;
+                if(bytes_next > maxpktsize)
+                        bytes_next = maxpktsize;
+                preloaded = (preload && bytes_next);
+                if(preloaded)
+                        bytesWr(rSNDFIFO, bytes_next, data_p + bytes_tosend);
+                rcode = waitXfer(timeout, &hrsl); //wait for the completion IRQ
+                if(rcode)
+                        goto breakout;
+                rcode = (hrsl & 0x0f);
 
                 while(rcode && ((long)(millis() - timeout) < 0L)) {
                         switch(rcode) {
@@ -343,27 +363,41 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
                                         break;
                                 case hrTOGERR:
                                         // yes, we flip it wrong here so that next time it is actually correct!
-                                        pep->bmSndToggle = (regRd(rHRSL) & bmSNDTOGRD) ? 0 : 1;
+                                        pep->bmSndToggle = (hrsl & bmSNDTOGRD) ? 0 : 1;
                                         regWr(rHCTL, (pep->bmSndToggle) ? bmSNDTOG1 : bmSNDTOG0); //set toggle value
                                         break;
                                 default:
                                         goto breakout;
                         }//switch( rcode
 
-                        /* process NAK according to Host out NAK bug */
+                        /* process NAK according to Host out NAK bug. The preload may have gone into */
+                        /* the buffer handed back by the NAK, so the whole packet is written again   */
+                        /* and the next one is loaded after this one is through.                     */
                         regWr(rSNDBC, 0);
-                        regWr(rSNDFIFO, *data_p);
+                        if(preloaded) {
+                                bytesWr(rSNDFIFO, bytes_tosend, data_p);
+                                preloaded = false;
+                        } else
+                                regWr(rSNDFIFO, *data_p);
                         regWr(rSNDBC, bytes_tosend);
                         regWr(rHXFR, (tokOUT | pep->epAddr)); //dispatch packet
-                        while(!(regRd(rHIRQ) & bmHXFRDNIRQ)); //wait for the completion IRQ
-                        regWr(rHIRQ, bmHXFRDNIRQ); //clear IRQ
-                        rcode = (regRd(rHRSL) & 0x0f);
+                        rcode = waitXfer(timeout, &hrsl); //wait for the completion IRQ
+                        if(rcode)
+                                goto breakout;
+                        rcode = (hrsl & 0x0f);
                 }//while( rcode && ....
                 bytes_left -= bytes_tosend;
                 data_p += bytes_tosend;
+                bytes_tosend = bytes_next;
+                if(bytes_tosend && !preloaded)
+                        bytesWr(rSNDFIFO, bytes_tosend, data_p); //filling output FIFO
+                preload = (nak_count == 0 && retry_count == 0); //a NAKing device would only make us load twice
         }//while( bytes_left...
 breakout:
 
+        if(preloaded)
+                regWr(rSNDBC, 0); //discard the preloaded packet, resets the SNDFIFO write pointer
+
         pep->bmSndToggle = (regRd(rHRSL) & bmSNDTOGRD) ? 1 : 0; //bmSNDTOG1 : bmSNDTOG0;  //update toggle
         return ( rcode); //should be 0 in all cases
 }
@@ -375,31 +409,19 @@ breakout:
 /* return codes 0x00-0x0f are HRSLT( 0x00 being success ), 0xff means timeout                       */
 uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
         unsigned long timeout = millis() + USB_XFER_TIMEOUT;
-        uint8_t tmpdata;
         uint8_t rcode = hrSUCCESS;
+        uint8_t hrsl;
         uint8_t retry_count = 0;
         uint16_t nak_count = 0;
 
         while((long)(millis() - timeout) < 0L) {
                 regWr(rHXFR, (token | ep)); //launch the transfer
-                rcode = USB_ERROR_TRANSFER_TIMEOUT;
-
-                while((long)(millis() - timeout) < 0L) //wait for transfer completion
-                {
-                        tmpdata = regRd(rHIRQ);
-
-                        if(tmpdata & bmHXFRDNIRQ) {
-                                regWr(rHIRQ, bmHXFRDNIRQ); //clear the interrupt
-                                rcode = 0x00;
-                                break;
-                        }//if( tmpdata & bmHXFRDNIRQ
-
-                }//while ( millis() < timeout
+                rcode = waitXfer(timeout, &hrsl); //wait for transfer completion
 
                 //if (rcode != 0x00) //exit if timeout
                 //        return ( rcode);
 
-                rcode = (regRd(rHRSL) & 0x0f); //analyze transfer result
+                rcode = (hrsl & 0x0f); //analyze transfer result
 
                 switch(rcode) {
                         case hrNAK:
@@ -420,6 +442,348 @@ uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
         return ( rcode);
 }
 
+/* Wait for the packet launched with HXFR to finish, clear HXFRDNIRQ and return HRSL in '*hrslptr'.  */
+/* HRSL is read with the HIRQ status bits that come with the command byte, so a single read tells    */
+/* whether the packet is done and how it went.                                                       */
+/* With USB_XFER_INTERRUPT the INT pin is watched, which costs no SPI traffic, and HRSL is read once */
+/* it goes low. INT is also pulled low by CONDETIRQ, in that case HRSL is polled as before.          */
+
+/* return codes 0x00 when done, 0xff means timeout                                                   */
+uint8_t USB::waitXfer(unsigned long timeout, uint8_t *hrslptr) {
+        uint8_t hirq;
+
+#if USB_XFER_INTERRUPT
+        while(intPinRd()) {
+                if((long)(millis() - timeout) >= 0L)
+                        break;
+                if(idleHandler)
+                        idleHandler();
+        }
+#endif
+        do {
+                *hrslptr = regRdIrq(rHRSL, &hirq);
+                if(hirq & bmHXFRDNIRQ) {
+                        regWr(rHIRQ, bmHXFRDNIRQ); //clear the interrupt
+                        return 0x00;
+                }
+        } while((long)(millis() - timeout) < 0L);
+        return USB_ERROR_TRANSFER_TIMEOUT;
+}
+
+/* Queue an asynchronous IN transfer of up to 'nbytes' bytes into 'data'. The transfer is done when the  */
+/* device sends a short packet or 'nbytes' bytes have been received, 'xfer->count' holds the byte count. */
+/* NAKs are counted per packet against the NAK limit of the endpoint, with USB_NAK_NONAK the request     */
+/* stays queued until the device sends data or it is cancelled.                                          */
+
+/* return codes 0 when queued, the callback gets the result of the transfer                              */
+uint8_t USB::inTransferAsync(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, UsbXfer *xfer, UsbXferCallback callback) {
+        return submitXfer(addr, ep, nbytes, data, xfer, callback, 0);
+}
+
+/* Queue an asynchronous OUT transfer of 'nbytes' bytes from 'data'. See inTransferAsync() */
+uint8_t USB::outTransferAsync(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, UsbXfer *xfer, UsbXferCallback callback) {
+        return submitXfer(addr, ep, nbytes, data, xfer, callback, bmUSB_XFER_OUT);
+}
+
+/* Remove a queued transfer without calling back. Bytes already transferred stay in 'xfer->count' */
+void USB::cancelXfer(UsbXfer *xfer) {
+        UsbXfer **pp = &xferQueue;
+
+        while(*pp) {
+                if(*pp == xfer) {
+                        *pp = xfer->next;
+                        break;
+                }
+                pp = &(*pp)->next;
+        }
+        xfer->flags &= ~bmUSB_XFER_PENDING;
+}
+
+uint8_t USB::submitXfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, UsbXfer *xfer, UsbXferCallback callback, uint8_t flags) {
+        if(!xfer || !data || (xfer->flags & bmUSB_XFER_PENDING))
+                return USB_ERROR_INVALID_ARGUMENT;
+
+        EpInfo *pep = getEpInfoEntry(addr, ep);
+
+        if(!pep)
+                return USB_ERROR_EP_NOT_FOUND_IN_TBL;
+
+        if(pep->maxPktSize < 1 || pep->maxPktSize > 64)
+                return USB_ERROR_INVALID_MAX_PKT_SIZE;
+
+        xfer->next = NULL;
+        xfer->callback = callback;
+        xfer->data = data;
+        xfer->length = nbytes;
+        xfer->count = 0;
+        xfer->nakCount = 0;
+        xfer->retryCount = 0;
+        xfer->addr = addr;
+        xfer->ep = ep;
+        xfer->flags = flags | bmUSB_XFER_PENDING;
+
+        UsbXfer **pp = &xferQueue;
+
+        while(*pp)
+                pp = &(*pp)->next;
+        *pp = xfer;
+        return 0;
+}
+
+/* Send one packet of a queued transfer. The toggle is restored from and saved to the endpoint record */
+/* around every packet, since packets to other endpoints go out in between.                           */
+
+/* returns true when the transfer is finished, '*rcodeptr' is then its result                         */
+bool USB::xferStep(UsbXfer *xfer, uint8_t *rcodeptr) {
+        EpInfo *pep = NULL;
+        uint16_t nak_limit = 0;
+        uint8_t pktsize = 0;
+        uint8_t hrsl, hirq;
+
+        uint8_t rcode = SetAddress(xfer->addr, xfer->ep, &pep, nak_limit);
+
+        if(rcode)
+                goto done;
+
+        if(xfer->flags & bmUSB_XFER_OUT) {
+                uint16_t left = xfer->length - xfer->count;
+
+                if(!left)
+                        goto done;
+                pktsize = (left >= pep->maxPktSize) ? pep->maxPktSize : left;
+                regWr(rHCTL, (pep->bmSndToggle) ? bmSNDTOG1 : bmSNDTOG0); //set toggle value
+                bytesWr(rSNDFIFO, pktsize, xfer->data + xfer->count); //filling output FIFO
+                regWr(rSNDBC, pktsize); //set number of bytes
+                regWr(rHXFR, (tokOUT | pep->epAddr)); //dispatch packet
+        } else {
+                regWr(rHCTL, (pep->bmRcvToggle) ? bmRCVTOG1 : bmRCVTOG0); //set toggle value
+                regWr(rHXFR, (tokIN | pep->epAddr)); //dispatch packet
+        }
+
+        rcode = waitXfer(millis() + USB_XFER_TIMEOUT, &hrsl);
+
+        if(rcode)
+                goto done;
+
+        rcode = (hrsl & 0x0f);
+
+        switch(rcode) {
+                case hrSUCCESS:
+                        break;
+                case hrNAK:
+                        /* the packet is reloaded next time, per Maxim Application Note 4000 the buffer is not reused */
+                        if(xfer->flags & bmUSB_XFER_OUT)
+                                regWr(rSNDBC, 0);
+                        /* nothing to report for this interval */
+                        if((xfer->flags & bmUSB_XFER_POLL) && !xfer->count)
+                                goto done;
+                        xfer->nakCount++;
+                        if(nak_limit && (xfer->nakCount == nak_limit))
+                                goto done;
+                        return false;
+                case hrTIMEOUT:
+                        xfer->retryCount++;
+                        if(xfer->retryCount == USB_RETRY_LIMIT)
+                                goto done;
+                        return false;
+                case hrTOGERR:
+                        // yes, we flip it wrong here so that next time it is actually correct!
+                        if(xfer->flags & bmUSB_XFER_OUT)
+                                pep->bmSndToggle = (hrsl & bmSNDTOGRD) ? 0 : 1;
+                        else
+                                pep->bmRcvToggle = (hrsl & bmRCVTOGRD) ? 0 : 1;
+                        xfer->retryCount++;
+                        if(xfer->retryCount == USB_RETRY_LIMIT)
+                                goto done;
+                        return false;
+                default:
+                        goto done;
+        }
+
+        xfer->nakCount = 0;
+        xfer->retryCount = 0;
+
+        if(xfer->flags & bmUSB_XFER_OUT) {
+                pep->bmSndToggle = (hrsl & bmSNDTOGRD) ? 1 : 0; //update toggle
+                xfer->count += pktsize;
+                return (xfer->count >= xfer->length);
+        }
+
+        pktsize = regRdIrq(rRCVBC, &hirq); //number of received bytes, HIRQ comes with it
+
+        if((hirq & bmRCVDAVIRQ) == 0) {
+                rcode = 0xf0; //receive error
+                goto done;
+        }
+
+        {
+                uint16_t left = xfer->length - xfer->count;
+                uint8_t len = (pktsize > left) ? left : pktsize;
+
+                rcvFifoRd(len, xfer->data + xfer->count); // read and free the buffer
+                xfer->count += len;
+        }
+        pep->bmRcvToggle = (hrsl & bmRCVTOGRD) ? 1 : 0; //update toggle
+
+        /* The transfer is complete under two conditions:           */
+        /* 1. The device sent a short packet (L.T. maxPacketSize)   */
+        /* 2. 'length' bytes have been transferred.                 */
+        return ((pktsize < pep->maxPktSize) || (xfer->count >= xfer->length));
+
+done:
+        *rcodeptr = rcode;
+        return true;
+}
+
+/* Give every queued transfer one packet, in the order they were queued. A request that is not finished */
+/* goes to the back of the queue, so a NAKing endpoint does not hold up the others. Callbacks may queue  */
+/* or cancel requests.                                                                                   */
+void USB::xferTask(void) {
+        uint8_t n = 0;
+
+        for(UsbXfer *p = xferQueue; p; p = p->next)
+                n++;
+
+        while(n-- && xferQueue) {
+                UsbXfer *xfer = xferQueue;
+                uint8_t rcode = 0;
+
+                xferQueue = xfer->next;
+                xfer->next = NULL;
+
+                if(!xferStep(xfer, &rcode)) {
+                        UsbXfer **pp = &xferQueue;
+
+                        while(*pp)
+                                pp = &(*pp)->next;
+                        *pp = xfer;
+                        continue;
+                }
+                xfer->flags &= ~bmUSB_XFER_PENDING;
+                if((xfer->flags & bmUSB_XFER_POLL) && !pollDone((UsbPoll*)xfer, rcode))
+                        continue;
+                if(xfer->callback)
+                        xfer->callback(xfer, rcode);
+        }
+}
+
+/* Drop the queued transfers and polled endpoints of a device that went away, without calling back */
+void USB::dropXfers(uint8_t addr) {
+        UsbXfer **pp = &xferQueue;
+
+        while(*pp) {
+                if((*pp)->addr == addr) {
+                        (*pp)->flags &= ~bmUSB_XFER_PENDING;
+                        *pp = (*pp)->next;
+                } else
+                        pp = &(*pp)->next;
+        }
+
+        UsbPoll **ppoll = &pollList;
+
+        while(*ppoll) {
+                if((*ppoll)->xfer.addr == addr)
+                        *ppoll = (*ppoll)->next;
+                else
+                        ppoll = &(*ppoll)->next;
+        }
+}
+
+/* Poll an IN endpoint every 'interval' ms, 0 polls on every Task(). Each poll asks for up to 'nbytes'    */
+/* bytes into 'data'. The callback is called when the device sent data, with 'xfer->count' bytes, or when */
+/* the poll failed. NAKs are not reported. Polls stay registered until unregisterPoll(), ReleaseDevice()  */
+/* or a bus detach.                                                                                        */
+
+/* return codes 0 when registered                                                                          */
+uint8_t USB::registerPoll(uint8_t addr, uint8_t ep, uint8_t interval, uint16_t nbytes, uint8_t* data, UsbPoll *poll, UsbXferCallback callback) {
+        if(!poll || !data)
+                return USB_ERROR_INVALID_ARGUMENT;
+
+        for(UsbPoll *p = pollList; p; p = p->next)
+                if(p == poll)
+                        return USB_ERROR_INVALID_ARGUMENT;
+
+        if(!getEpInfoEntry(addr, ep))
+                return USB_ERROR_EP_NOT_FOUND_IN_TBL;
+
+        poll->xfer.next = NULL;
+        poll->xfer.callback = callback;
+        poll->xfer.data = data;
+        poll->xfer.length = nbytes;
+        poll->xfer.count = 0;
+        poll->xfer.addr = addr;
+        poll->xfer.ep = ep;
+        poll->xfer.flags = bmUSB_XFER_POLL;
+        poll->interval = interval;
+        poll->due = millis();
+
+        poll->next = pollList;
+        pollList = poll;
+        return 0;
+}
+
+/* Stop polling an endpoint, a poll in progress is cancelled without calling back */
+void USB::unregisterPoll(UsbPoll *poll) {
+        UsbPoll **pp = &pollList;
+
+        while(*pp) {
+                if(*pp == poll) {
+                        *pp = poll->next;
+                        break;
+                }
+                pp = &(*pp)->next;
+        }
+        cancelXfer(&poll->xfer);
+}
+
+/* Queue a poll for every endpoint that is due, the one that is most overdue first, so it gets the */
+/* bus before the others in xferTask(). An endpoint is not polled again until its last poll ended. */
+void USB::pollTask(void) {
+        unsigned long now = millis();
+
+        while(1) {
+                UsbPoll *next = NULL;
+                long late = 0;
+
+                for(UsbPoll *p = pollList; p; p = p->next) {
+                        long l = (long)(now - p->due);
+
+                        if(l < 0L || (p->xfer.flags & bmUSB_XFER_PENDING))
+                                continue;
+                        if(!next || l > late) {
+                                next = p;
+                                late = l;
+                        }
+                }
+                if(!next)
+                        break;
+
+                UsbXfer *xfer = &next->xfer;
+                uint8_t rcode = submitXfer(xfer->addr, xfer->ep, xfer->length, xfer->data, xfer, xfer->callback, bmUSB_XFER_POLL);
+
+                if(rcode) {
+                        // the endpoint is gone from the device table, stop polling it
+                        unregisterPoll(next);
+                        if(xfer->callback)
+                                xfer->callback(xfer, rcode);
+                }
+        }
+}
+
+/* Schedule the next poll of an endpoint. A poll that ended late does not cause a burst of polls   */
+/* to catch up, the next one is due right away and the interval counts from there.                */
+
+/* returns false when the driver need not be called back                                           */
+bool USB::pollDone(UsbPoll *poll, uint8_t rcode) {
+        unsigned long now = millis();
+
+        poll->due += poll->interval;
+        if((long)(now - poll->due) > 0L)
+                poll->due = now;
+
+        return !(rcode == hrNAK && !poll->xfer.count);
+}
+
 /* USB main task. Performs enumeration/cleanup */
 void USB::Task(void) //USB state machine
 {
@@ -520,6 +884,8 @@ void USB::Task(void) //USB state machine
                                 usb_task_state = USB_STATE_RUNNING;
                         break;
                 case USB_STATE_RUNNING:
+                        pollTask();
+                        xferTask();
                         break;
                 case USB_STATE_ERROR:
                         //MAX3421E::Init();
@@ -750,6 +1116,8 @@ uint8_t USB::ReleaseDevice(uint8_t addr) {
         if(!addr)
                 return 0;
 
+        dropXfers(addr);
+
         for(uint8_t i = 0; i < USB_NUMDEVICES; i++) {
                 if(!devConfig[i]) continue;
                 if(devConfig[i]->GetAddress() == addr)
@@ -192,10 +192,50 @@ public:
         virtual void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset) = 0;
 };
 
+/* Asynchronous transfer request. The record is owned by the caller and must stay valid while it is queued. */
+/* The callback is called from USB::Task() when the transfer is done, with the same return codes as        */
+/* inTransfer() and outTransfer()                                                                           */
+struct UsbXfer;
+
+typedef void (*UsbXferCallback)(UsbXfer *xfer, uint8_t rcode);
+
+#define bmUSB_XFER_OUT          0x01    // OUT transfer, IN otherwise
+#define bmUSB_XFER_PENDING      0x02    // queued, not finished yet
+#define bmUSB_XFER_POLL         0x04    // issued by the poll scheduler, a NAK ends the poll
+
+struct UsbXfer {
+        UsbXfer *next; // next queued request, used by USB
+        UsbXferCallback callback;
+        void *context; // free for the owner of the request
+        uint8_t *data;
+        uint16_t length; // number of bytes requested
+        uint16_t count; // number of bytes transferred so far
+        uint16_t nakCount; // NAKs for the current packet
+        uint8_t retryCount; // bus timeouts for the current packet
+        uint8_t addr;
+        uint8_t ep;
+        uint8_t flags;
+
+        bool isPending() {
+                return (flags & bmUSB_XFER_PENDING);
+        };
+};
+
+/* IN endpoint polled by the USB core, see USB::registerPoll(). Owned by the driver like UsbXfer */
+struct UsbPoll {
+        UsbXfer xfer; // transfer issued on every poll, must be the first member
+        UsbPoll *next; // next registered endpoint, used by USB
+        unsigned long due; // millis() of the next poll
+        uint8_t interval; // poll interval in ms, bInterval for interrupt endpoints
+};
+
 class USB : public MAX3421E {
         AddressPoolImpl<USB_NUMDEVICES> addrPool;
         USBDeviceConfig* devConfig[USB_NUMDEVICES];
         uint8_t bmHubPre;
+        void (*idleHandler)(void);
+        UsbXfer *xferQueue;
+        UsbPoll *pollList;
 
 public:
         USB(void);
@@ -208,6 +248,13 @@ public:
                 bmHubPre &= (~bmHUBPRE);
         };
 
+        /* Called repeatedly while waiting for a packet when USB_XFER_INTERRUPT is set. A transfer is in    */
+        /* flight, so the handler must not call into USB or the MAX3421E. INT is polled, not attached to an */
+        /* interrupt, so the handler must not sleep either.                                                 */
+        void setIdleHandler(void (*handler)(void)) {
+                idleHandler = handler;
+        };
+
         AddressPool& GetAddressPool() {
                 return (AddressPool&)addrPool;
         };
@@ -247,6 +294,15 @@ public:
         uint8_t outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data);
         uint8_t dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit);
 
+        /* Asynchronous transfers, advanced by one packet per endpoint on every Task() */
+        uint8_t inTransferAsync(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, UsbXfer *xfer, UsbXferCallback callback);
+        uint8_t outTransferAsync(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, UsbXfer *xfer, UsbXferCallback callback);
+        void cancelXfer(UsbXfer *xfer);
+
+        /* Endpoint poll scheduler, calls back when an interrupt or bulk IN endpoint has data */
+        uint8_t registerPoll(uint8_t addr, uint8_t ep, uint8_t interval, uint16_t nbytes, uint8_t* data, UsbPoll *poll, UsbXferCallback callback);
+        void unregisterPoll(UsbPoll *poll);
+
         void Task(void);
 
         uint8_t DefaultAddressing(uint8_t parent, uint8_t port, bool lowspeed);
@@ -262,6 +318,13 @@ private:
         uint8_t OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8_t *data);
         uint8_t InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t *data);
         uint8_t AttemptConfig(uint8_t driver, uint8_t parent, uint8_t port, bool lowspeed);
+        uint8_t waitXfer(unsigned long timeout, uint8_t *hrslptr);
+        uint8_t submitXfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, UsbXfer *xfer, UsbXferCallback callback, uint8_t flags);
+        bool xferStep(UsbXfer *xfer, uint8_t *rcodeptr);
+        void xferTask(void);
+        void dropXfers(uint8_t addr);
+        void pollTask(void);
+        bool pollDone(UsbPoll *poll, uint8_t rcode);
 };
 
 #if 0 //defined(USB_METHODS_INLINE)
@@ -19,8 +19,6 @@ e-mail   :  support@circuitsathome.com
 
 HIDUniversal::HIDUniversal(USB *p) :
 HID(p),
-qNextPollTime(0),
-pollInterval(0),
 bPollEnable(false),
 bHasReportId(false) {
         Initialize();
@@ -55,6 +53,10 @@ void HIDUniversal::Initialize() {
 
                 for(uint8_t j = 0; j < maxEpPerInterface; j++)
                         hidInterfaces[i].epIndex[j] = 0;
+
+                pollEp[i].xfer.flags = 0;
+                pollEp[i].xfer.context = this;
+                pollEp[i].interval = 0;
         }
         for(uint8_t i = 0; i < totalEndpoints; i++) {
                 epInfo[i].epAddr = 0;
@@ -65,7 +67,6 @@ void HIDUniversal::Initialize() {
         bNumEP = 1;
         bNumIface = 0;
         bConfNum = 0;
-        pollInterval = 0;
 
         ZeroMemory(constBuffLen, prevBuf);
 }
@@ -240,6 +241,21 @@ uint8_t HIDUniversal::Init(uint8_t parent, uint8_t port, bool lowspeed) {
 
         USBTRACE("HU configured\r\n");
 
+        // Hand the interrupt IN endpoints to the USB core, reports come back in PollDone()
+        for(uint8_t i = 0; i < bNumIface; i++) {
+                uint8_t index = hidInterfaces[i].epIndex[epInterruptInIndex];
+
+                if(index == 0)
+                        continue;
+
+                uint16_t len = (epInfo[index].maxPktSize > constBuffLen) ? constBuffLen : epInfo[index].maxPktSize;
+
+                rcode = pUsb->registerPoll(bAddress, epInfo[index].epAddr, pollEp[i].interval, len, pollBuf, pollEp + i, PollDone);
+
+                if(rcode)
+                        goto FailRegisterPoll;
+        }
+
         OnInitSuccessful();
 
         bPollEnable = true;
@@ -273,6 +289,12 @@ FailSetConfDescr:
 FailSetIdle:
 #ifdef DEBUG_USB_HOST
         USBTRACE("SetIdle:");
+        goto Fail;
+#endif
+
+FailRegisterPoll:
+#ifdef DEBUG_USB_HOST
+        USBTRACE("RegisterPoll:");
 #endif
 
 #ifdef DEBUG_USB_HOST
@@ -329,8 +351,8 @@ void HIDUniversal::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint
                 // Fill in the endpoint index list
                 piface->epIndex[index] = bNumEP; //(pep->bEndpointAddress & 0x0F);
 
-                if(pollInterval < pep->bInterval) // Set the polling interval as the largest polling interval obtained from endpoints
-                        pollInterval = pep->bInterval;
+                if(index == epInterruptInIndex) // Each interface is polled at the interval of its own endpoint
+                        pollEp[piface - hidInterfaces].interval = pep->bInterval;
 
                 bNumEP++;
         }
@@ -338,11 +360,13 @@ void HIDUniversal::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint
 }
 
 uint8_t HIDUniversal::Release() {
+        for(uint8_t i = 0; i < maxHidInterfaces; i++)
+                pUsb->unregisterPoll(pollEp + i);
+
         pUsb->GetAddressPool().FreeAddress(bAddress);
 
         bNumEP = 1;
         bAddress = 0;
-        qNextPollTime = 0;
         bPollEnable = false;
         return 0;
 }
@@ -364,59 +388,39 @@ void HIDUniversal::SaveBuffer(uint8_t len, uint8_t *src, uint8_t *dest) {
                 dest[i] = src[i];
 }
 
-uint8_t HIDUniversal::Poll() {
-        uint8_t rcode = 0;
-
-        if(!bPollEnable)
-                return 0;
+void HIDUniversal::PollDone(UsbXfer *xfer, uint8_t rcode) {
+        HIDUniversal *hid = (HIDUniversal*)xfer->context;
 
-        if((long)(millis() - qNextPollTime) >= 0L) {
-                qNextPollTime = millis() + pollInterval;
-
-                uint8_t buf[constBuffLen];
-
-                for(uint8_t i = 0; i < bNumIface; i++) {
-                        uint8_t index = hidInterfaces[i].epIndex[epInterruptInIndex];
-                        uint16_t read = (uint16_t)epInfo[index].maxPktSize;
-
-                        ZeroMemory(constBuffLen, buf);
-
-                        uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[index].epAddr, &read, buf);
-
-                        if(rcode) {
-                                if(rcode != hrNAK)
-                                        USBTRACE3("(hiduniversal.h) Poll:", rcode, 0x81);
-                                return rcode;
-                        }
-
-                        if(read > constBuffLen)
-                                read = constBuffLen;
+        if(rcode) {
+                USBTRACE3("(hiduniversal.h) Poll:", rcode, 0x81);
+                return;
+        }
+        hid->ParseReport((uint8_t)xfer->count);
+}
 
-                        bool identical = BuffersIdentical(read, buf, prevBuf);
+void HIDUniversal::ParseReport(uint8_t read) {
+        bool identical = BuffersIdentical(read, pollBuf, prevBuf);
 
-                        SaveBuffer(read, buf, prevBuf);
+        SaveBuffer(read, pollBuf, prevBuf);
 
-                        if(identical)
-                                return 0;
+        if(identical)
+                return;
 #if 0
-                        Notify(PSTR("\r\nBuf: "), 0x80);
+        Notify(PSTR("\r\nBuf: "), 0x80);
 
-                        for(uint8_t i = 0; i < read; i++) {
-                                D_PrintHex<uint8_t > (buf[i], 0x80);
-                                Notify(PSTR(" "), 0x80);
-                        }
+        for(uint8_t i = 0; i < read; i++) {
+                D_PrintHex<uint8_t > (pollBuf[i], 0x80);
+                Notify(PSTR(" "), 0x80);
+        }
 
-                        Notify(PSTR("\r\n"), 0x80);
+        Notify(PSTR("\r\n"), 0x80);
 #endif
-                        ParseHIDData(this, bHasReportId, (uint8_t)read, buf);
+        ParseHIDData(this, bHasReportId, read, pollBuf);
 
-                        HIDReportParser *prs = GetReportParser(((bHasReportId) ? *buf : 0));
+        HIDReportParser *prs = GetReportParser(((bHasReportId) ? *pollBuf : 0));
 
-                        if(prs)
-                                prs->Parse(this, bHasReportId, (uint8_t)read, buf);
-                }
-        }
-        return rcode;
+        if(prs)
+                prs->Parse(this, bHasReportId, read, pollBuf);
 }
 
 
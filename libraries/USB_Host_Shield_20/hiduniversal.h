@@ -46,11 +46,11 @@ class HIDUniversal : public HID {
         uint8_t bConfNum; // configuration number
         uint8_t bNumIface; // number of interfaces in the configuration
         uint8_t bNumEP; // total number of EP in the configuration
-        uint32_t qNextPollTime; // next poll time
-        uint8_t pollInterval;
+        UsbPoll pollEp[maxHidInterfaces]; // interrupt IN endpoint of each interface, polled by the USB core
         bool bPollEnable; // poll enable flag
 
         static const uint16_t constBuffLen = 64; // event buffer length
+        uint8_t pollBuf[constBuffLen]; // event buffer, a poll is a single packet so the interfaces share it
         uint8_t prevBuf[constBuffLen]; // previous event buffer
 
         void Initialize();
@@ -59,6 +59,8 @@ class HIDUniversal : public HID {
         void ZeroMemory(uint8_t len, uint8_t *buf);
         bool BuffersIdentical(uint8_t len, uint8_t *buf1, uint8_t *buf2);
         void SaveBuffer(uint8_t len, uint8_t *src, uint8_t *dest);
+        void ParseReport(uint8_t read);
+        static void PollDone(UsbXfer *xfer, uint8_t rcode);
 
 protected:
         EpInfo epInfo[totalEndpoints];
@@ -88,7 +90,6 @@ public:
         // USBDeviceConfig implementation
         virtual uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
         virtual uint8_t Release();
-        virtual uint8_t Poll();
 
         virtual uint8_t GetAddress() {
                 return bAddress;
@@ -47,6 +47,21 @@ e-mail   :  support@circuitsathome.com
 /* Set this to a one to use the xmem2 lock. This is needed for multitasking and threading */
 #define USE_XMEM_SPI_LOCK 0
 
+////////////////////////////////////////////////////////////////////////////////
+// Transfer completion
+////////////////////////////////////////////////////////////////////////////////
+
+/* Set this to 1 to wait for the end of each USB packet on the INT pin instead
+ * of reading HIRQ over SPI until the packet is done. While a packet is in
+ * flight the function set with USB::setIdleHandler() is called over and over
+ * until INT goes low, it can do short jobs but must not call into USB or the
+ * MAX3421E. No interrupt is attached to INT, so the handler must not put the
+ * CPU to sleep.
+ */
+#ifndef USB_XFER_INTERRUPT
+#define USB_XFER_INTERRUPT 0
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Wii IR camera
 ////////////////////////////////////////////////////////////////////////////////
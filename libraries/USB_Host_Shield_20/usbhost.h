@@ -102,7 +102,9 @@ public:
         uint8_t* bytesWr(uint8_t reg, uint8_t nbytes, uint8_t* data_p);
         void gpioWr(uint8_t data);
         uint8_t regRd(uint8_t reg);
+        uint8_t regRdIrq(uint8_t reg, uint8_t* hirq_p);
         uint8_t* bytesRd(uint8_t reg, uint8_t nbytes, uint8_t* data_p);
+        uint8_t* rcvFifoRd(uint8_t nbytes, uint8_t* data_p);
         uint8_t gpioRd();
         uint16_t reset();
         int8_t Init();
@@ -115,6 +117,11 @@ public:
         uint8_t getVbusState(void) {
                 return vbusState;
         };
+
+        /* INT pin level, low while an enabled interrupt is pending */
+        uint8_t intPinRd(void) {
+                return INTR::IsSet();
+        };
         void busprobe();
         uint8_t GpxHandler();
         uint8_t IntHandler();
@@ -179,10 +186,10 @@ uint8_t* MAX3421e< SPI_SS, INTR >::bytesWr(uint8_t reg, uint8_t nbytes, uint8_t*
 #else
         SPDR = (reg | 0x02); //set WR bit and send register number
         while(nbytes) {
-                while(!(SPSR & (1 << SPIF))); //check if previous byte was sent
-                SPDR = (*data_p); // send next data byte
+                uint8_t b = *data_p++; // fetch the next byte while the last one is shifted out
                 nbytes--;
-                data_p++; // advance data pointer
+                while(!(SPSR & (1 << SPIF))); //check if previous byte was sent
+                SPDR = b; // send next data byte
         }
         while(!(SPSR & (1 << SPIF)));
 #endif
@@ -226,6 +233,33 @@ uint8_t MAX3421e< SPI_SS, INTR >::regRd(uint8_t reg) {
         XMEM_RELEASE_SPI();
         return (rv);
 }
+
+/* single host register read, also returns the HIRQ status bits clocked out with the command byte */
+template< typename SPI_SS, typename INTR >
+uint8_t MAX3421e< SPI_SS, INTR >::regRdIrq(uint8_t reg, uint8_t* hirq_p) {
+#if USING_SPI4TEENSY3
+        *hirq_p = regRd(rHIRQ); // spi4teensy3 does not return the byte received with the command
+        return regRd(reg);
+#else
+        XMEM_ACQUIRE_SPI();
+        SPI_SS::Clear();
+#if (defined(ARDUINO_SAM_DUE) && defined(__SAM3X8E__)) ||  defined(RBL_NRF51822)
+        *hirq_p = SPI.transfer(reg);
+        uint8_t rv = SPI.transfer(0);
+        SPI_SS::Set();
+#else
+        SPDR = reg;
+        while(!(SPSR & (1 << SPIF)));
+        *hirq_p = SPDR;
+        SPDR = 0; //send empty byte
+        while(!(SPSR & (1 << SPIF)));
+        SPI_SS::Set();
+        uint8_t rv = SPDR;
+#endif
+        XMEM_RELEASE_SPI();
+        return (rv);
+#endif
+}
 /* multiple-byte register read  */
 
 /* returns a pointer to a memory position after last read   */
@@ -246,27 +280,30 @@ uint8_t* MAX3421e< SPI_SS, INTR >::bytesRd(uint8_t reg, uint8_t nbytes, uint8_t*
 #else
         SPDR = reg;
         while(!(SPSR & (1 << SPIF))); //wait
-        while(nbytes) {
+        if(nbytes) {
                 SPDR = 0; //send empty byte
-                nbytes--;
-                while(!(SPSR & (1 << SPIF)));
-#if 0
-                {
-                        *data_p = SPDR;
-                        printf("%2.2x ", *data_p);
+                while(--nbytes) {
+                        while(!(SPSR & (1 << SPIF)));
+                        uint8_t b = SPDR;
+                        SPDR = 0; // start the next byte as soon as this one arrives
+                        *data_p++ = b;
                 }
-                data_p++;
-        }
-        printf("\r\n");
-#else
+                while(!(SPSR & (1 << SPIF)));
                 *data_p++ = SPDR;
         }
-#endif
 #endif
         SPI_SS::Set();
         XMEM_RELEASE_SPI();
         return ( data_p);
 }
+
+/* read a received packet from RCVFIFO and free the buffer for the next one */
+template< typename SPI_SS, typename INTR >
+uint8_t* MAX3421e< SPI_SS, INTR >::rcvFifoRd(uint8_t nbytes, uint8_t* data_p) {
+        data_p = bytesRd(rRCVFIFO, nbytes, data_p);
+        regWr(rHIRQ, bmRCVDAVIRQ); // Clear the IRQ & free the buffer
+        return ( data_p);
+}
 /* GPIO read. See gpioWr for explanation */
 
 /* GPIN pins are in high nibbles of IOPINS1, IOPINS2    */
@@ -317,7 +354,11 @@ int8_t MAX3421e< SPI_SS, INTR >::Init() {
 
         regWr(rMODE, bmDPPULLDN | bmDMPULLDN | bmHOST); // set pull-downs, Host
 
+#if USB_XFER_INTERRUPT
+        regWr(rHIEN, bmCONDETIE | bmHXFRDNIE); //connection detection and transfer done, see USB::waitXfer()
+#else
         regWr(rHIEN, bmCONDETIE | bmFRAMEIE); //connection detection
+#endif
 
         /* check if device is connected */
         regWr(rHCTL, bmSAMPLEBUS); // sample USB bus
@@ -358,7 +399,11 @@ int8_t MAX3421e< SPI_SS, INTR >::Init(int mseconds) {
 
         regWr(rMODE, bmDPPULLDN | bmDMPULLDN | bmHOST); // set pull-downs, Host
 
+#if USB_XFER_INTERRUPT
+        regWr(rHIEN, bmCONDETIE | bmHXFRDNIE); //connection detection and transfer done, see USB::waitXfer()
+#else
         regWr(rHIEN, bmCONDETIE | bmFRAMEIE); //connection detection
+#endif
 
         /* check if device is connected */
         regWr(rHCTL, bmSAMPLEBUS); // sample USB bus